@@ -1,14 +1,31 @@
 #include "raylib.h"
+#include "rlgl.h"
 #include <stdint.h>
 #include <initializer_list>
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
 #include <vector>
+#include <unordered_map>
 #include <string>
 #include <format>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <bit>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 
@@ -31,6 +48,10 @@
 #define ROLL_COST_INCREASE_FACTOR 1.1
 #define POLICE_TIME 60
 #define START_MAX_UPGRADES 5
+#define START_MONEY 1500
+#define SIM_DT (1.0 / 120.0)    // the simulation always steps by this much
+#define MAX_FRAME_TIME 0.25     // longer frames get dropped instead of caught up
+#define START_ROLL_COST 50
 
 typedef uint8_t  u8;
 typedef uint16_t u16;
@@ -43,16 +64,207 @@ typedef int64_t  i64;
 
 typedef i64 Money;
 
+// xoshiro256** streams. Every machine owns one so reels, shakes and the
+// shop don't share state, and split() hands out non-overlapping substreams
+// (2^128 draws apart) for simulation threads.
+u64 splitmix64(u64& state) {
+    u64 z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+struct Rng {
+    u64 s[4] = {};
+
+    Rng() : Rng(0) {
+    }
+
+    Rng(u64 seed) {
+        for (int i = 0; i < 4; i++)
+            s[i] = splitmix64(seed);
+    }
+
+    static u64 rotl(u64 x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    u64 next() {
+        u64 result = rotl(s[1] * 5, 7) * 9;
+        u64 t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    u32 next_u32() {
+        return u32(next() >> 32);
+    }
+
+    // uniform in [min, max], no modulo bias (Lemire)
+    int range(int min, int max) {
+        u64 span = u64(i64(max) - i64(min)) + 1;
+        u64 m = u64(next_u32()) * span;
+        if (u32(m) < span) {
+            u32 floor = u32(-span) % u32(span);
+            while (u32(m) < floor)
+                m = u64(next_u32()) * span;
+        }
+        return int(i64(min) + i64(m >> 32));
+    }
+
+    // uniform in [0, 1)
+    float unit() {
+        return (next() >> 40) * (1.0f / (1 << 24));
+    }
+
+    // standard normal, Box-Muller
+    double gauss() {
+        double u = ((next() >> 11) + 1) * (1.0 / 9007199254740992.0); // (0, 1]
+        double v = (next() >> 11) * (1.0 / 9007199254740992.0);
+        return sqrt(-2 * log(u)) * cos(2 * PI * v);
+    }
+
+    void fill(u32* out, int count) {
+        for (int i = 0; i + 1 < count; i += 2) {
+            u64 x = next();
+            out[i] = u32(x >> 32);
+            out[i + 1] = u32(x);
+        }
+        if (count & 1) out[count - 1] = next_u32();
+    }
+
+    // same as 2^128 calls to next()
+    void jump() {
+        static const u64 JUMP[] = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+        u64 t[4] = {};
+        for (u64 jump : JUMP) {
+            for (int b = 0; b < 64; b++) {
+                if (jump & (u64(1) << b))
+                    for (int i = 0; i < 4; i++) t[i] ^= s[i];
+                next();
+            }
+        }
+        for (int i = 0; i < 4; i++) s[i] = t[i];
+    }
+
+    // returns the current stream and moves this one 2^128 ahead
+    Rng split() {
+        Rng stream = *this;
+        jump();
+        return stream;
+    }
+};
+
+// xoshiro128+ running BATCH_RNG_LANES independent streams side by side.
+// Every step is the same operations over plain arrays, so the compiler
+// turns fill() into SIMD. Only for simulation, the upper bits are the good ones.
+#define BATCH_RNG_LANES 8
+
+struct BatchRng {
+    u32 s[4][BATCH_RNG_LANES] = {};
+
+    // every lane takes its state from its own substream of rng
+    void seed(Rng& rng) {
+        for (int lane = 0; lane < BATCH_RNG_LANES; lane++) {
+            Rng stream = rng.split();
+            for (int i = 0; i < 4; i++)
+                s[i][lane] = stream.next_u32();
+        }
+    }
+
+    // count is rounded up to a multiple of BATCH_RNG_LANES, out must have room
+    void fill(u32* out, int count) {
+        for (int base = 0; base < count; base += BATCH_RNG_LANES) {
+            for (int lane = 0; lane < BATCH_RNG_LANES; lane++) {
+                u32 result = s[0][lane] + s[3][lane];
+                u32 t = s[1][lane] << 9;
+                s[2][lane] ^= s[0][lane];
+                s[3][lane] ^= s[1][lane];
+                s[1][lane] ^= s[2][lane];
+                s[0][lane] ^= s[3][lane];
+                s[2][lane] ^= t;
+                s[3][lane] = (s[3][lane] << 11) | (s[3][lane] >> 21);
+                out[base + lane] = result;
+            }
+        }
+    }
+};
+
+// A formatted value that only gets reformatted when the value changes, so
+// HUD numbers hand the text cache the same string frame after frame.
+struct Label {
+    i64  value    = INT64_MIN;
+    char text[64] = {};
+
+    template <typename... Args>
+    const char* format(i64 new_value, const char* fmt, Args... args) {
+        if (new_value != value) {
+            value = new_value;
+            snprintf(text, sizeof(text), fmt, args...);
+        }
+        return text;
+    }
+};
+
+// Something that happens at an absolute game_time. action() returns false to
+// have the scheduler delete the timer; returning true keeps it, and then it
+// must have moved its deadline past now or unscheduled itself.
 struct Timer {
-    const char* text;
-    const char* tooltip;
-    double time_left;
+    const char* text     = nullptr;
+    const char* tooltip  = nullptr;
+    double      deadline = 0;
+    int         heap_index = -1; // slot in its scheduler, -1 if not scheduled
     Money cost = 0;
+    Label time_label;
+    Label cost_label;
 
+    double time_left();
     virtual bool action() = 0;
     virtual ~Timer() {}
 };
 
+// Indexed binary min-heap on deadlines. Adding, moving and removing a timer
+// are O(log n), and nothing is looked at until the earliest one is due.
+struct Scheduler {
+    std::vector<Timer*> heap;
+
+    void   add(Timer* timer, double deadline);
+    void   move(Timer* timer, double deadline);
+    void   remove(Timer* timer);
+    void   run(double now);          // fires everything due, earliest first
+    int    peek(Timer** out, int k); // the next k timers in order, O(k^2) with k small
+    double next_deadline();          // INFINITY when empty
+    void   clear();                  // deletes the timers
+    void   sift_up(int i);
+    void   sift_down(int i);
+    void   place(Timer* timer, int i);
+};
+
+struct Machine;
+struct SlotMachine;
+
+// Picks a new shake offset every 20ms while the machine spins
+struct Timer_Shake : Timer {
+    Machine* machine = nullptr;
+    virtual bool action() override;
+};
+
+struct Timer_AutoSpin : Timer {
+    SlotMachine* machine = nullptr;
+    virtual bool action() override;
+};
+
+// Ends a spin, whether or not its reels were animated
+struct Timer_SpinStop : Timer {
+    SlotMachine* machine = nullptr;
+    virtual bool action() override;
+};
+
 enum class ShopEntryType {
     Machine,
     Upgrade,
@@ -64,15 +276,46 @@ enum class UpgradeType {
     Double_Stake,
 };
 
-struct TextOnScreen {
-    std::string text     = 0;
-    Vector2     pos      = {};
-    float       t        = 0;
-    float       duration = 4;
-    Color       color    = WHITE;
-    float       size     = 40;
-    Vector2     velocity = {0, -100};
-    float       gravity  = 1000;
+// Everything the player does goes through these, so a run can be replayed
+// from its seed and the list of commands. Only ever append.
+enum class CommandType : u8 {
+    Spin,           // arg: spot
+    BuySpot,        // arg: spot
+    BuyShopEntry,   // arg: shop slot
+    SelectMachine,  // arg: spot
+    Reroll,
+    FastForward,    // arg: seconds
+};
+
+struct Command {
+    u64         tick;
+    CommandType type;
+    u8          reserved[3];
+    i32         arg;
+};
+
+// Floating "+$N" texts, a fixed pool laid out per field so the update is a
+// few straight loops. Popups from the same source shortly after one another
+// add up in a single text instead of spawning new ones.
+#define MAX_TEXTS       512
+#define TEXT_LENGTH     24
+#define TEXT_DURATION   4
+#define TEXT_SIZE       40
+#define TEXT_GRAVITY    1000
+#define TEXT_COALESCE   0.5   // seconds a text keeps absorbing its source's popups
+
+struct TextPool {
+    int         count = 0;
+    float       x[MAX_TEXTS];
+    float       y[MAX_TEXTS];
+    float       prev_x[MAX_TEXTS];
+    float       prev_y[MAX_TEXTS];
+    float       velocity_x[MAX_TEXTS];
+    float       velocity_y[MAX_TEXTS];
+    float       t[MAX_TEXTS];
+    Money       amount[MAX_TEXTS];
+    const void* source[MAX_TEXTS];
+    char        text[MAX_TEXTS][TEXT_LENGTH];
 };
 
 struct ButtonState {
@@ -89,64 +332,167 @@ enum class GameScreen {
     Shop,
 };
 
+// Saves refer to machines by these, only ever append
+enum class MachineType : u8 {
+    None,
+    M1X1,
+    M3X1,
+    MB5,
+};
+
+#define MAX_MACHINE_TYPES 16
+
 struct Machine {
+    MachineType type = MachineType::None;
     Vector2 pos;
     double ev = 0;
     double win_percent = 0;
+    double variance = 0;
 
     int shake_x = 0;
     int shake_y = 0;
-    double shake_time = 0;
+    Timer_Shake shake_timer;
+    int spot = -1;         // where it stands
+    int placed_index = -1; // in placed_machines
     int upgrades = 0;
     Money stake = 1;
+    Rng rng;
 
-    virtual void update() = 0;
-    virtual void draw() = 0;
-    virtual ~Machine() {}
+    virtual void animate() {}     // moves the machine to where it's drawn this frame
+    virtual void draw() = 0;      // everything that changes from frame to frame
+    virtual void draw_chrome() {} // static parts, drawn once into the floor cache
+    virtual void layout() {}
+    virtual void click() {}
+    virtual bool shaking() { return false; }
+    virtual ~Machine();
 
     virtual void upgrade(UpgradeType type) {
         upgrades++;
     }
 
+    void start_shake();
     void shake();
 };
 
 struct ShopEntry {
     const char* name = "";
     const char* tagline = "";
+    Label price_label;
     virtual Money cost() { return 0; }
     virtual const char* lock_reason() { return nullptr; }
     virtual void buy() { }
     virtual void draw_icon(int x, int y) {
         DrawRectangle(x, y, 130, 180, RED);
     };
+    virtual ~ShopEntry() {}
 };
 
+// Walker/Vose alias table: one column per entry, a draw picks a column and
+// flips a biased coin between the column's own entry and its alias. O(1)
+// per draw and O(entries) memory no matter how big the weights get.
 template <typename T>
 struct Weights {
-    std::vector<T> array;
+    struct Column {
+        u32 threshold; // stay in this column if the coin is below this
+        T   entry;
+        T   alias;
+    };
+
+    std::vector<std::pair<T, int>> entries;
+    std::vector<Column> table;
+    int total = 0;
+    bool dirty = false; // added to since the last build()
 
     Weights() {
     }
 
     Weights(std::initializer_list<std::pair<T, int>> list) {
-        for (auto& item : list)
-            add(item.first, item.second);
+        for (auto& item : list) {
+            entries.push_back(item);
+            total += item.second;
+        }
+        build();
     }
 
     void add(T entry, int weight) {
-        for (int i = 0; i < weight; i++)
-            array.push_back(entry);
+        entries.push_back({ entry, weight });
+        total += weight;
+        dirty = true;
+    }
+
+    // call once all entries are in, before the first draw
+    void build() {
+        u32 n = entries.size();
+        table.resize(n);
+        dirty = false;
+
+        // thresholds are units / total in 32 bit fixed point
+        assert(u64(total) * n < (u64(1) << 32));
+
+        // Each column holds 'total' units, entry i brings weight * n of them.
+        std::vector<u64> units(n);
+        std::vector<u32> small, large;
+        for (u32 i = 0; i < n; i++) {
+            units[i] = u64(entries[i].second) * n;
+            (units[i] < u64(total) ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            u32 l = small.back(); small.pop_back();
+            u32 g = large.back();
+
+            table[l] = { u32((units[l] << 32) / total), entries[l].first, entries[g].first };
+
+            units[g] -= total - units[l];
+            if (units[g] < u64(total)) {
+                large.pop_back();
+                small.push_back(g);
+            }
+        }
+
+        // whatever is left is a full column (or rounding dust)
+        for (u32 i : large) table[i] = { 0, entries[i].first, entries[i].first };
+        for (u32 i : small) table[i] = { 0, entries[i].first, entries[i].first };
+    }
+
+    T generate(Rng& rng) const {
+        return pick(rng.next_u32());
     }
 
-    T generate() {
-        return array[GetRandomValue(0, array.size() - 1)];
+    // Maps a uniform 32 bit number onto the distribution. The high half of
+    // random * n is the column, the low half is an equally uniform coin.
+    T pick(u32 random) const {
+        assert(!dirty);
+        u64 m = u64(random) * table.size();
+        const Column& c = table[m >> 32];
+        return u32(m) < c.threshold ? c.entry : c.alias;
     }
 };
 
+// Expected win per spin (in money, stake included), its variance and the
+// chance that a spin wins anything
+struct Odds {
+    double ev         = 0;
+    double variance   = 0;
+    double win_chance = 0;
+};
+
+// Sampled odds, errors are 95% confidence half widths
+struct SimResult {
+    Odds   odds             = {};
+    double ev_error         = 0;
+    double win_chance_error = 0;
+    u64    spins            = 0;
+};
+
+// A picture somewhere in tex_atlas
+struct Sprite {
+    Rectangle src = {};
+};
+
 struct SlotTile {
     int     id;
-    Texture texture;
+    Sprite  sprite;
 };
 
 struct SlotBuffer {
@@ -154,22 +500,34 @@ struct SlotBuffer {
     int rows = 0;
     int buffer[MAX_SLOT_REELS][MAX_SLOT_ROWS] = {};
 
-    static SlotBuffer generate(int reels, int rows, Weights<int>& weights) {
-        SlotBuffer buffer = { reels, rows };
-        buffer.reels = reels;
-        buffer.rows = rows;
-
-        for (int reel = 0; reel < reels; reel++)
-            for (int row = 0; row < reels; row++)
-                buffer.buffer[reel][row] = weights.generate();
+    static SlotBuffer generate(int reels, int rows, Weights<int>& weights, Rng& rng) {
+        u32 random[MAX_SLOT_REELS * MAX_SLOT_ROWS];
+        rng.fill(random, reels * rows);
 
+        SlotBuffer buffer;
+        generate_batch(&buffer, 1, reels, rows, weights, random);
         return buffer;
     }
 
+    // count buffers at once, random has to hold count * reels * rows numbers
+    static void generate_batch(SlotBuffer* out, int count, int reels, int rows, Weights<int>& weights, const u32* random) {
+        for (int i = 0; i < count; i++) {
+            out[i].reels = reels;
+            out[i].rows = rows;
+            for (int reel = 0; reel < reels; reel++)
+                for (int row = 0; row < rows; row++)
+                    out[i].buffer[reel][row] = weights.pick(*random++);
+        }
+    }
+
     int& at(int reel, int row) {
         return buffer[reel][row];
     }
 
+    int at(int reel, int row) const {
+        return buffer[reel][row];
+    }
+
     void advance(int reel, int new_tile) {
         for (int row = rows - 1; row >= 1; row--)
             buffer[reel][row] = buffer[reel][row-1];
@@ -179,11 +537,18 @@ struct SlotBuffer {
 
 struct SlotMachine;
 
+// What a slot looks like and how it spins. spin() draws the result right
+// away and the spin ends spin_duration() later. In between, slots in view
+// scroll filler towards the result in their lane of the reel engine, see the
+// Reels section. Everything else just waits.
 struct Slot {
     SlotMachine*      machine          = nullptr;
     Rectangle         rect             = {};
     bool              spinning         = false;
-    float             spin_time        = 0;
+    int               lane             = -1;    // in its machine type's ReelGroup while animated
+    double            spin_start       = 0;
+    int               extra_rows       = 0;     // how much further the last reel goes this spin
+    SlotBuffer        result           = {};    // what buffer shows once the spin ends
     float             reel_offset_time = 0.1;
     int               spin_distance    = 10;
     int               spin_distance_per_reel = 3;
@@ -194,23 +559,19 @@ struct Slot {
     std::vector<SlotTile> tiles        = {};
     float             speed            = 300;
     float             row_height       = 40;
-    int               current_spin_distance = 0;
     double            last_tick        = 0;
     double            tick_rate        = 0.3;
 
-    float offsets[MAX_SLOT_REELS]       = {};
-    int   upper_buffer[MAX_SLOT_REELS]  = {};
-    int   spin_iter[MAX_SLOT_REELS]     = {};
-    bool stopped[MAX_SLOT_REELS]        = {};
-
-    // CALLBACKS:
-    void (*on_reel_stop)(Slot* slot, int reel) = nullptr;
-    void (*on_stop)(Slot* slot) = nullptr;
+    int   upper_buffer[MAX_SLOT_REELS]  = {}; // the tile coming in above each reel
 
     Rectangle get_reel_rect(int reel);
+    void layout(Rectangle rect);
     void spin(Money stake, Vector2 pos);
+    void extend_spin(int rows); // the last reel goes further, call from on_spin
 
-    void update();
+    double reel_duration(int reel, int extra_rows = 0);
+    double spin_duration(int extra_rows = 0);
+    float render_offset(int reel);
     void draw();
 
     virtual ~Slot() {}
@@ -218,24 +579,40 @@ struct Slot {
 
 struct SlotMachine : Machine {
     Slot slot = {};
-    Texture texture = {};
+    Sprite sprite = {};
     float auto_click_time = -1;
     double last_auto_click_time = 0;
+    Timer_AutoSpin auto_spin_timer;
+    Timer_SpinStop spin_stop_timer;
+    Money payout = 0; // what the spin in progress wins, known from the start
 
-    virtual void update() override;
+    virtual void layout() override;
+    virtual void click() override;
     virtual void upgrade(UpgradeType type) override;
     virtual void calculate_ev();
-    virtual Money calculate_win() = 0;
-    virtual void on_reel_stop(int reel) {}
+    virtual Money calculate_win(const SlotBuffer& buffer) = 0;
+    // Scores many buffers with one virtual call, used by the simulator.
+    // Must not touch the machine's state, it runs on several threads at once.
+    virtual void calculate_win_batch(const SlotBuffer* buffers, int count, Money* wins) = 0;
+    virtual void on_spin() {}               // slot.result is known, the reels haven't moved yet
+    virtual void on_reel_stop(int reel) {}  // only when the reels are animated
     virtual void on_stop();
+    void finish_spin();
+    virtual double expected_spin_time();
+    virtual double auto_spin_cycle();
+    virtual bool shaking() override { return slot.spinning; }
+    void schedule_auto_spin();
 
+    virtual void animate() override;
     virtual void draw() override;
+    virtual void draw_chrome() override;
     virtual void draw_background();
     virtual void draw_spin_button();
     virtual void draw_slot();
+    Rectangle spin_button_rect();
 
     SlotMachine();
-    virtual ~SlotMachine() {}
+    virtual ~SlotMachine();
 };
 
 // --- Renderer State -----------------------------------------
@@ -246,37 +623,91 @@ float                     screen_scale    = 1;
 Camera2D                  camera          = {};
 Vector2                   mouse           = {};
 double                    game_time       = 0;
-double                    dt              = 0;
+u64                       sim_tick        = 0;     // steps since the run started
+double                    dt              = 0;     // simulation step
+double                    frame_dt        = 0;     // real time since the last frame
+double                    sim_accumulator = 0;     // real time the simulation still owes
+float                     sim_alpha       = 0;     // how far between two steps we're rendering
 double                    run_start_time  = 0;
-std::vector<TextOnScreen> texts           = {};
+bool                      headless        = false; // no window, no audio, no texts
+bool                      debug_overlay   = false; // F3
+bool                      floor_dirty     = true;  // the floor cache needs redrawing
+TextPool                  texts           = {};
 const char*               tooltip         = nullptr;
 
-// --- Textures -----------------------------------------------
+// --- Sprites ------------------------------------------------
+
+Texture tex_atlas;
+Sprite  spr_white; // solid white, raylib's shapes draw with it
+Sprite  spr_font;  // raylib's default font, text draws from here
 
-Texture tex_background;
-Texture tex_m3x1;
-Texture tex_mb5;
-Texture tex_m1x1;
+Sprite spr_background;
+Sprite spr_m3x1;
+Sprite spr_mb5;
+Sprite spr_m1x1;
 
-Texture tex_tile_0;
-Texture tex_tile_dot;
-Texture tex_tile_orange;
-Texture tex_tile_cherry;
-Texture tex_tile_7;
-Texture tex_tile_777;
+Sprite spr_tile_0;
+Sprite spr_tile_dot;
+Sprite spr_tile_orange;
+Sprite spr_tile_cherry;
+Sprite spr_tile_7;
+Sprite spr_tile_777;
 
-Texture tex_tile_9;
-Texture tex_tile_10;
-Texture tex_tile_j;
-Texture tex_tile_q;
-Texture tex_tile_k;
+Sprite spr_tile_9;
+Sprite spr_tile_10;
+Sprite spr_tile_j;
+Sprite spr_tile_q;
+Sprite spr_tile_k;
 
 // --- Sounds -------------------------------------------------
+// Every sound is decoded once and each voice holds an alias of it, so a play
+// just sets pitch and volume on a free voice. With all voices busy the oldest
+// voice of the lowest priority gets stolen, and a sound can only start so
+// many times per frame, so nine fast machines can't flood the mixer.
+
+#define MAX_VOICES 12
+
+enum SoundId {
+    SND_UPGRADE,
+    SND_WIN_1,
+    SND_WIN_2,
+    SND_TICK,
+    SND_REEL_STOP,
+    SOUND_COUNT,
+};
+
+struct SoundDef {
+    const char* path;
+    int   priority;      // can steal voices from lower ones
+    int   max_per_frame;
+    float volume;
+    float volume_jitter; // every play adds up to this much
+    float pitch;
+    float pitch_jitter;
+
+    Sound source;
+    Sound aliases[MAX_VOICES];
+    int   played_this_frame;
+};
+
+SoundDef sounds[SOUND_COUNT] = {
+    // path                     priority  per frame  volume     pitch
+    { "assets/upgrade.wav",     3,        1,         1.0, 0,    1.0, 0   },
+    { "assets/win1.wav",        2,        2,         1.0, 0,    1.0, 0   },
+    { "assets/win2.wav",        2,        2,         1.0, 0,    1.0, 0   },
+    { "assets/hat.wav",         0,        2,         0.3, 0.3,  0.9, 0.1 },
+    { "assets/reelstop.wav",    1,        3,         1.0, 0,    1.0, 0   },
+};
+
+struct Voice {
+    int sound    = -1; // what it played last
+    int priority = 0;
+    u64 started  = 0;  // play counter, older voices get stolen first
+};
+
+Voice voices[MAX_VOICES];
+u64   voice_plays = 0;
 
-Sound snd_upgrade;
-Sound snd_win[2];
-Sound snd_hat[48];
-Sound snd_reelstop;
 Music msc_police;
 Music msc_anticipation;
 int msc_anticipation_count = 0;
@@ -284,10 +715,13 @@ int msc_anticipation_count = 0;
 // --- Game state ---------------------------------------------
 
 GameScreen  screen       = GameScreen::Machines;
-Money       money        = 1500;
-Money       roll_cost    = 50;
+Rng         world_rng;   // shop rolls and everything else that isn't a machine's
+Money       money        = START_MONEY;
+Money       roll_cost    = START_ROLL_COST;
 int         max_upgrades = START_MAX_UPGRADES;
-std::vector<Timer*> timers;
+Scheduler   timers;      // bills and the police, the HUD lists these
+Scheduler   events;      // per machine: auto spins and shakes
+Rng         fx_rng;      // looks only, so headless and windowed runs agree
 Timer* police_timer = nullptr;
 
 const Money spot_prices[9] = {
@@ -296,13 +730,26 @@ const Money spot_prices[9] = {
     20000,  500000, 1000000,
 };
 
-bool spot_unlocked[9] = {};
-Machine* machines[9] = {};
+// the floor, see the Floor section
+int                   floor_shells     = 1;  // the starting 3x3 is one shell
+int                   spot_count       = 9;
+int                   unlocked_spots   = 0;
+int                   illegal_machines = 0;  // machines over max_upgrades
+std::vector<Machine*> machines;              // by spot, nullptr where empty
+std::vector<u8>       spot_unlocked;
+std::vector<Machine*> placed_machines;       // every machine on the floor, in no particular order
+std::vector<int>      free_spots;            // unlocked and empty, a min-heap, taken spots leave lazily
+std::vector<u8>       free_spot_queued;      // by spot, whether it's in free_spots
 double display_money = 0;
 
 std::vector<ShopEntry*> shop_entries;
 
-void gain_money(Money money, Vector2 pos);
+void gain_money(Money money, Vector2 pos, const Machine* source = nullptr);
+void issue_command(CommandType type, int arg = 0);
+int spot_of(Machine* machine);
+void remove_machine(Machine* machine);
+bool spot_visible(int i);
+Vector2 floor_to_view(Vector2 pos);
 bool button(ButtonState state);
 
 Weights<ShopEntryType> shop_types_weights;
@@ -332,785 +779,4345 @@ float Remap(float val, float old_min, float old_max, float new_min, float new_ma
     return lerp(new_min, new_max, t);
 }
 
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 float color_clamp(float x) {
     if (x < 0) return 0;
     if (x > 255) return 255;
     return x;
 }
 
-// --- Machine methods ----------------------------------------
-
-void Machine::shake() {
-    if (game_time - shake_time > 0.02) {
-        shake_time = game_time;
-        shake_x = GetRandomValue(-1, 1);
-        shake_y = GetRandomValue(-2, 2);
-    }
-    pos.x += shake_x;
-    pos.y += shake_y;
-}
-
-// --- Slot methods -------------------------------------------
+// --- Floor --------------------------------------------------
+// Spots grow outwards from the starting 3x3 in square shells, the next one
+// opens once every spot of the current ones is bought. Up to a few thousand
+// of them, so nothing walks all spots per frame: the machines on the floor
+// are also kept in one dense list, empty spots in a min-heap, and only the
+// cells in view get drawn. The floor scrolls and zooms in its own camera on
+// the left of the viewport, at home it lines up with the viewport exactly.
+
+#define FLOOR_MAX_SHELLS   32     // 65x65 spots
+#define FLOOR_VIEW_WIDTH   650    // the HUD starts right of this
+#define FLOOR_MIN_ZOOM     0.08f
+#define FLOOR_DETAIL_ZOOM  0.5f   // below this reels, buttons and labels aren't drawn
+#define FLOOR_PAN_SPEED    1200   // view pixels per second with the keys
+#define SPOT_PRICE_GROWTH  1.003  // per spot past the first nine
+#define SPOT_STRIDE_X      (MACHINE_WIDTH + MACHINE_GAP_X)
+#define SPOT_STRIDE_Y      (MACHINE_HEIGHT + MACHINE_GAP_Y)
+
+struct FloorView {
+    Vector2 target = {};  // floor position at the top left of the view
+    float   zoom   = 1;
+    int     x0 = 0, y0 = 0, x1 = 2, y1 = 2; // cells in view, inclusive
+};
 
-void Slot::spin(Money stake, Vector2 pos) {
-    if (!spinning) {
-        for (int reel = 0; reel < reels; reel++) {
-            upper_buffer[reel] = weights.generate();
-            spin_iter[reel] = 0;
-            stopped[reel] = false;
-        }
+FloorView floor_view;
 
-        current_spin_distance = spin_distance;
-        spinning = true;
-        spin_time = 0;
-        gain_money(-stake, pos);
+// Spots 0-8 are the 3x3 in reading order, cell (1, 1) in the middle. Shell
+// r >= 2 then adds the 8r cells around it, clockwise from the top left.
+void spot_cell(int i, int& x, int& y) {
+    if (i < 9) {
+        x = i % 3;
+        y = i / 3;
+        return;
     }
+
+    int r = (int(sqrt(double(i))) + 1) / 2;
+    int j = i - (2 * r - 1) * (2 * r - 1);
+    int side = 2 * r;
+    int dx, dy;
+    if      (j < side)     { dx = -r + j;             dy = -r; }
+    else if (j < 2 * side) { dx = r;                  dy = -r + (j - side); }
+    else if (j < 3 * side) { dx = r - (j - 2 * side); dy = r; }
+    else                   { dx = -r;                 dy = r - (j - 3 * side); }
+    x = 1 + dx;
+    y = 1 + dy;
 }
 
-Rectangle Slot::get_reel_rect(int reel) {
-    float avail_space_x = rect.width - reels * 40;
-    float gap_x = avail_space_x / (reels + 1);
+// the spot in a cell, -1 if there's none (yet)
+int spot_at(int x, int y) {
+    int dx = x - 1;
+    int dy = y - 1;
+    int r = std::max(abs(dx), abs(dy));
+    if (r <= 1) return y * 3 + x;
+
+    int side = 2 * r;
+    int j;
+    if      (dy == -r && dx < r)  j = dx + r;
+    else if (dx == r && dy < r)   j = side + dy + r;
+    else if (dy == r && dx > -r)  j = 2 * side + r - dx;
+    else                          j = 3 * side + r - dy;
+
+    int i = (2 * r - 1) * (2 * r - 1) + j;
+    return i < spot_count ? i : -1;
+}
 
-    return Rectangle {
-        .x = this->rect.x + gap_x * (reel + 1) + reel * 40,
-        .y = this->rect.y,
-        .width = 40,
-        .height = this->rect.height,
+Vector2 spot_position(int i) {
+    int x, y;
+    spot_cell(i, x, y);
+    return {
+        float(TOP_PADDING + x * SPOT_STRIDE_X),
+        float(RIGHT_PADDING + y * SPOT_STRIDE_Y),
     };
 }
 
-void play_tick_sound() {
-    static int x = 0;
-    x++;
-    if (x >= 48) x = 0;
-    PlaySound(snd_hat[x]);
+Money spot_price(int i) {
+    if (i < 9) return spot_prices[i];
+    return llround(spot_prices[8] * pow(SPOT_PRICE_GROWTH, i - 8) / 1000) * 1000;
 }
 
-void play_win_sound() {
-    static int x = 0;
-    x++;
-    if (x >= 2) x = 0;
-    PlaySound(snd_win[x]);
+int shell_spots(int shells) {
+    return (2 * shells + 1) * (2 * shells + 1);
 }
 
+bool spot_visible(int i) {
+    int x, y;
+    spot_cell(i, x, y);
+    return x >= floor_view.x0 && x <= floor_view.x1 && y >= floor_view.y0 && y <= floor_view.y1;
+}
 
-void Slot::update() {
-    if (spinning) {
-        spin_time += dt;
-
-        if (game_time - last_tick > tick_rate) {
-            play_tick_sound();
-            last_tick = game_time;
-        }
+// floor position to where it shows in the viewport
+Vector2 floor_to_view(Vector2 pos) {
+    return {
+        (pos.x - floor_view.target.x) * floor_view.zoom,
+        (pos.y - floor_view.target.y) * floor_view.zoom,
+    };
+}
 
-        bool done = true;
-        for (int reel = 0; reel < reels; reel++) {
-            if (spin_time < reel_offset_time * reel) continue;
+// the floor as the screen sees it, on top of the viewport camera
+Camera2D floor_camera(Camera2D base) {
+    return { .offset = base.offset, .target = floor_view.target, .rotation = 0, .zoom = base.zoom * floor_view.zoom };
+}
 
-            if (stopped[reel]) {
-                continue;
-            }
+// Keeps the floor in view, or the view on the floor once it's bigger.
+// At home the view is a bit wider than the 3x3, which then stays put.
+void clamp_floor_view() {
+    int cells = 2 * floor_shells + 1;
+    float min_x = (1 - floor_shells) * SPOT_STRIDE_X;
+    float min_y = (1 - floor_shells) * SPOT_STRIDE_Y;
+    float max_x = min_x + cells * SPOT_STRIDE_X + TOP_PADDING;
+    float max_y = min_y + cells * SPOT_STRIDE_Y + RIGHT_PADDING;
+
+    float fit = std::min(FLOOR_VIEW_WIDTH / (max_x - min_x), VIEWPORT_HEIGHT / (max_y - min_y));
+    floor_view.zoom = std::clamp(floor_view.zoom, std::clamp(fit, FLOOR_MIN_ZOOM, 1.0f), 1.0f);
+
+    float view_w = FLOOR_VIEW_WIDTH / floor_view.zoom;
+    float view_h = VIEWPORT_HEIGHT / floor_view.zoom;
+    floor_view.target.x = std::clamp(floor_view.target.x, std::min(min_x, max_x - view_w), std::max(min_x, max_x - view_w));
+    floor_view.target.y = std::clamp(floor_view.target.y, std::min(min_y, max_y - view_h), std::max(min_y, max_y - view_h));
+
+    Vector2 end = { floor_view.target.x + view_w, floor_view.target.y + view_h };
+    floor_view.x0 = floorf((floor_view.target.x - TOP_PADDING) / SPOT_STRIDE_X);
+    floor_view.y0 = floorf((floor_view.target.y - RIGHT_PADDING) / SPOT_STRIDE_Y);
+    floor_view.x1 = floorf((end.x - TOP_PADDING) / SPOT_STRIDE_X);
+    floor_view.y1 = floorf((end.y - RIGHT_PADDING) / SPOT_STRIDE_Y);
+}
 
-            int required_distance = current_spin_distance + spin_distance_per_reel * reel;
-            if (spin_iter[reel] >= required_distance) {
-                if (!stopped[reel]) {
-                    stopped[reel] = true;
-                    spin_iter[reel] = 99999999; // set to high value in case current_spin_distance changes
-                    offsets[reel] = 0;
-                    if (this->on_reel_stop) this->on_reel_stop(this, reel); 
-                }
-            }
-            else {
-                offsets[reel] += speed * dt;
-                done = false;
+// Wheel zooms around the cursor, right or middle drag and WASD/arrows pan,
+// Home goes back to the start. mouse is in viewport coordinates here.
+void update_floor_view(Camera2D base) {
+    bool over = mouse.x >= 0 && mouse.x < FLOOR_VIEW_WIDTH && mouse.y >= 0 && mouse.y < VIEWPORT_HEIGHT;
+
+    float wheel = GetMouseWheelMove();
+    if (over && wheel != 0) {
+        Vector2 anchor = GetScreenToWorld2D(GetMousePosition(), floor_camera(base));
+        floor_view.zoom *= powf(1.15f, wheel);
+        clamp_floor_view();
+        floor_view.target.x = anchor.x - mouse.x / floor_view.zoom;
+        floor_view.target.y = anchor.y - mouse.y / floor_view.zoom;
+    }
 
-                while (offsets[reel] > row_height) {
-                    buffer.advance(reel, upper_buffer[reel]);
-                    upper_buffer[reel] = weights.generate();
-                    offsets[reel] -= row_height;
+    if (over && (IsMouseButtonDown(MOUSE_BUTTON_RIGHT) || IsMouseButtonDown(MOUSE_BUTTON_MIDDLE))) {
+        Vector2 delta = GetMouseDelta();
+        floor_view.target.x -= delta.x / base.zoom / floor_view.zoom;
+        floor_view.target.y -= delta.y / base.zoom / floor_view.zoom;
+    }
 
-                    spin_iter[reel]++;
-                    if (spin_iter[reel] >= required_distance) {
-                    }
-                }
-            }
-        }
+    float pan = FLOOR_PAN_SPEED * frame_dt / floor_view.zoom;
+    if (IsKeyDown(KEY_A) || IsKeyDown(KEY_LEFT))  floor_view.target.x -= pan;
+    if (IsKeyDown(KEY_D) || IsKeyDown(KEY_RIGHT)) floor_view.target.x += pan;
+    if (IsKeyDown(KEY_W) || IsKeyDown(KEY_UP))    floor_view.target.y -= pan;
+    if (IsKeyDown(KEY_S) || IsKeyDown(KEY_DOWN))  floor_view.target.y += pan;
+    if (IsKeyPressed(KEY_HOME)) floor_view = {};
 
-        if (done) {
-            spinning = false;
-            if (this->on_stop) this->on_stop(this);
-        }
-    }
+    clamp_floor_view();
 }
 
-void Slot::draw() {
-    float avail_space_x = rect.width - reels * 40;
-    float avail_space_y = rect.height - rows * 40;
-    float gap_x = avail_space_x / (reels + 1);
-    float gap_y = avail_space_y / (rows + 1);
+// --- Atlas --------------------------------------------------
+// Every picture gets packed into tex_atlas at startup, and raylib's shapes
+// draw with a white patch of it, so sprites and rectangles never switch
+// textures and the whole floor goes out in a handful of batches.
 
-    row_height = 40 + gap_y;
+#define ATLAS_WIDTH   2048
+#define ATLAS_PADDING 1
 
-    Vector2 scissor_pos = GetWorldToScreen2D({rect.x, rect.y}, camera);
-    BeginScissorMode(scissor_pos.x, scissor_pos.y, rect.width * camera.zoom, rect.height * camera.zoom);
+struct AtlasImage {
+    Image   image;
+    Sprite* sprite;
+    bool    owned; // freed once uploaded, pictures straight from the pack aren't
+};
 
-    for (int reel = 0; reel < reels; reel++) {
-        for (int row = -1; row < rows; row++) {
-            int tile = row >= 0 ? buffer.buffer[reel][row] : upper_buffer[reel];
+std::vector<AtlasImage> atlas_images;
 
-            Vector2 pos = {
-                .x = this->rect.x + gap_x * (reel + 1) + reel * 40,
-                .y = this->rect.y + gap_y * (row + 1) + row * 40 + offsets[reel],
-            };
+// takes an RGBA8 image
+void atlas_add(Image image, Sprite* sprite, bool owned = true) {
+    atlas_images.push_back({ image, sprite, owned });
+}
 
-            DrawTexture(tiles[tile].texture, pos.x, pos.y, WHITE);
+// Shelf packer, tallest first. Creates an empty atlas texture, the pictures
+// go in one by one with atlas_upload() so loading can spread them over frames.
+void atlas_pack() {
+    atlas_add(GenImageColor(4, 4, WHITE), &spr_white);
+
+    Image font = LoadImageFromTexture(GetFontDefault().texture);
+    ImageFormat(&font, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    atlas_add(font, &spr_font);
+
+    std::sort(atlas_images.begin(), atlas_images.end(), [](auto& a, auto& b) {
+        return a.image.height > b.image.height;
+    });
+
+    int x = 0, y = 0, shelf_height = 0;
+    for (auto& [image, sprite, owned] : atlas_images) {
+        if (x + image.width > ATLAS_WIDTH) {
+            x = 0;
+            y += shelf_height + ATLAS_PADDING;
+            shelf_height = 0;
         }
+        sprite->src = { float(x), float(y), float(image.width), float(image.height) };
+        shelf_height = std::max(shelf_height, image.height);
+        x += image.width + ATLAS_PADDING;
     }
 
-    EndScissorMode();
+    Image atlas = GenImageColor(ATLAS_WIDTH, y + shelf_height, BLANK);
+    tex_atlas = LoadTextureFromImage(atlas);
+    UnloadImage(atlas);
 }
 
-// --- SlotMachine methods ------------------------------------
+void atlas_upload(int i) {
+    auto& [image, sprite, owned] = atlas_images[i];
+    UpdateTextureRec(tex_atlas, sprite->src, image.data);
+    if (owned) UnloadImage(image);
+    image = {};
+}
 
-SlotMachine::SlotMachine() {
-    slot.machine = this;
+void atlas_finish() {
+    atlas_images.clear();
 
-    slot.on_reel_stop = [](Slot* slot, int reel) {
-        slot->machine->on_reel_stop(reel);
-        PlaySound(snd_reelstop);
-    };
+    // stay away from the edges so filtering never picks up a neighbour
+    Rectangle w = spr_white.src;
+    SetShapesTexture(tex_atlas, { w.x + 1, w.y + 1, w.width - 2, w.height - 2 });
+}
 
-    slot.on_stop = [](Slot* slot) {
-        slot->machine->on_stop();
-    };
+void draw_sprite(Sprite sprite, float x, float y, Color tint = WHITE) {
+    DrawTextureRec(tex_atlas, sprite.src, { float(int(x)), float(int(y)) }, tint);
 }
 
-void SlotMachine::on_stop() {
-    Money win = calculate_win();
-    gain_money(win, { slot.rect.x, slot.rect.y });
+// Draws only the part of the sprite inside clip. Reels use this instead of
+// a scissor, which would flush the batch for every machine.
+void draw_sprite_clipped(Sprite sprite, float x, float y, Rectangle clip, Color tint = WHITE) {
+    x = int(x);
+    y = int(y);
+
+    float left   = std::max(x, clip.x);
+    float top    = std::max(y, clip.y);
+    float right  = std::min(x + sprite.src.width, clip.x + clip.width);
+    float bottom = std::min(y + sprite.src.height, clip.y + clip.height);
+    if (right <= left || bottom <= top) return;
+
+    Rectangle src = { sprite.src.x + left - x, sprite.src.y + top - y, right - left, bottom - top };
+    Rectangle dst = { left, top, right - left, bottom - top };
+    DrawTexturePro(tex_atlas, src, dst, {}, 0, tint);
 }
 
-void SlotMachine::update() {
-    slot.update();
+void draw_sprite_scaled(Sprite sprite, float x, float y, float scale, Color tint = WHITE) {
+    Rectangle dst = { x, y, sprite.src.width * scale, sprite.src.height * scale };
+    DrawTexturePro(tex_atlas, sprite.src, dst, {}, 0, tint);
 }
 
-void SlotMachine::upgrade(UpgradeType type) {
-    Machine::upgrade(type);
+// --- Text ---------------------------------------------------
+// DrawText's layout with the default font, except a string is only laid out
+// once: its quads live in a cache keyed by string and size, and drawing it
+// again just copies them into the batch. The font sits in tex_atlas, so text
+// never breaks a batch either.
 
-    switch (type) {
-        case UpgradeType::Speed: {
-            slot.speed *= 1.3;
-            slot.reel_offset_time /= 1.3;
-            slot.tick_rate /= 1.1;
-            if (slot.tick_rate < 0.05)
-                slot.tick_rate = 0.05;
-            break;
-        }
-        case UpgradeType::Double_Stake: {
-            stake *= 2;
-            break;
-        }
-        case UpgradeType::Auto_Click: {
-            if (auto_click_time < 0) auto_click_time = 5;
-            else auto_click_time /= 2;
-            break;
-        }
-    }
-}
+#define TEXT_CACHE_MAX   1024 // start evicting past this many runs
+#define TEXT_CACHE_STALE 120  // frames an unused run survives an eviction pass
 
-void SlotMachine::draw_background() {
-    DrawTexture(texture, pos.x, pos.y - 9, WHITE);
-}
+struct Glyph {
+    Rectangle src; // in the atlas, padding included
+    float     offset_x;
+    float     offset_y;
+    float     advance;
+};
 
-void SlotMachine::draw_spin_button() {
-    Color color = { 0, 0, 255, 255 };
+struct GlyphQuad {
+    float x0, y0, x1, y1; // relative to the text position
+    float u0, v0, u1, v1;
+};
 
-    Rectangle button = {
-        .x = pos.x + float(MACHINE_WIDTH - BUTTON_WIDTH) / 2,
-        .y = pos.y + float(MACHINE_HEIGHT - BUTTON_HEIGHT) - 8,
-        .width = float(BUTTON_WIDTH),
-        .height = float(BUTTON_HEIGHT),
-    };
+struct TextRun {
+    std::string            text;
+    int                    size      = 0;
+    int                    width     = 0; // same as MeasureText
+    std::vector<GlyphQuad> quads;
+    u64                    last_used = 0;
+};
 
-    if (slot.spinning) {
-        button.y += 12;
-        button.height -= 12;
-        color = { 0, 0, 160, 80 };
+Glyph glyphs[128]; // ASCII only, control codes draw as '?'
+int   font_base_size = 10;
+std::unordered_map<u64, TextRun> text_cache;
+u64   text_frame = 0;
+
+// call after atlas_finish()
+void build_glyphs() {
+    Font font = GetFontDefault();
+    font_base_size = font.baseSize;
+    float pad = font.glyphPadding;
+
+    for (int c = 0; c < 128; c++) {
+        int index = GetGlyphIndex(font, c < 32 ? '?' : c);
+        Rectangle rec = font.recs[index];
+        GlyphInfo info = font.glyphs[index];
+
+        glyphs[c] = {
+            .src      = { spr_font.src.x + rec.x - pad, spr_font.src.y + rec.y - pad, rec.width + 2*pad, rec.height + 2*pad },
+            .offset_x = info.offsetX - pad,
+            .offset_y = info.offsetY - pad,
+            .advance  = info.advanceX ? float(info.advanceX) : rec.width,
+        };
     }
-    else {
-        bool spin = false;
-        if (auto_click_time >= 0 && game_time - last_auto_click_time > auto_click_time) {
-            spin = true;
-            last_auto_click_time = game_time;
-        }
+}
 
-        if (CheckCollisionPointRec(mouse, button) && !select_machine) {
-            color = Color { 32, 80, 255, 255 };
-            if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) spin = true;
+void layout_run(TextRun& run, const char* text, int size) {
+    run.text = text;
+    run.size = size;
+    run.quads.clear();
+
+    // DrawText's rules: never below 10px, one pixel of spacing per 10px
+    int font_size = std::max(size, 10);
+    float spacing = font_size / 10;
+    float scale = float(font_size) / font_base_size;
+
+    float x = 0, y = 0, width = 0;
+    for (const char* c = text; *c; c++) {
+        if (*c == '\n') {
+            width = std::max(width, x - spacing);
+            x = 0;
+            y += font_size + 2;
+            continue;
         }
 
-        if (spin) slot.spin(stake, {button.x, button.y});
+        u8 ch = *c;
+        const Glyph& g = glyphs[ch < 128 ? ch : '?'];
+        if (ch != ' ' && ch != '\t') {
+            float x0 = x + g.offset_x * scale;
+            float y0 = y + g.offset_y * scale;
+            run.quads.push_back({
+                x0, y0, x0 + g.src.width * scale, y0 + g.src.height * scale,
+                g.src.x / tex_atlas.width, g.src.y / tex_atlas.height,
+                (g.src.x + g.src.width) / tex_atlas.width, (g.src.y + g.src.height) / tex_atlas.height,
+            });
+        }
+        x += g.advance * scale + spacing;
     }
+    run.width = std::max(width, x - spacing);
+}
 
-    DrawRectangleRec(button, color);
-    DrawText("SPIN", button.x + 6, button.y + 10, 20, WHITE);
+TextRun& text_run(const char* text, int size) {
+    u64 key = 0xCBF29CE484222325ull ^ u64(size); // FNV-1a
+    for (const char* c = text; *c; c++) key = (key ^ u8(*c)) * 0x100000001B3ull;
+
+    TextRun& run = text_cache[key];
+    if (run.size != size || run.text != text) layout_run(run, text, size);
+    run.last_used = text_frame;
+    return run;
 }
 
-void SlotMachine::draw() {
-    if (slot.spinning) shake();
+void draw_run(const TextRun& run, float x, float y, Color color) {
+    x = int(x);
+    y = int(y);
+
+    rlSetTexture(tex_atlas.id);
+    rlBegin(RL_QUADS);
+    rlColor4ub(color.r, color.g, color.b, color.a);
+    rlNormal3f(0, 0, 1);
+    for (const GlyphQuad& q : run.quads) {
+        rlTexCoord2f(q.u0, q.v0); rlVertex2f(x + q.x0, y + q.y0);
+        rlTexCoord2f(q.u0, q.v1); rlVertex2f(x + q.x0, y + q.y1);
+        rlTexCoord2f(q.u1, q.v1); rlVertex2f(x + q.x1, y + q.y1);
+        rlTexCoord2f(q.u1, q.v0); rlVertex2f(x + q.x1, y + q.y0);
+    }
+    rlEnd();
+    rlSetTexture(0);
+}
 
-    draw_background();
-    draw_slot();
-    draw_spin_button();
+void draw_text(const char* text, float x, float y, int size, Color color) {
+    draw_run(text_run(text, size), x, y, color);
 }
 
-void SlotMachine::draw_slot() {
-    slot.rect = { pos.x + 10, pos.y + 60, 164, 86 };
-    slot.draw();
+int measure_text(const char* text, int size) {
+    return text_run(text, size).width;
 }
 
-void SlotMachine::calculate_ev() {
-    SlotBuffer buffer;
-    Money total = 0;
-    int spins = 100000;
-    int no_wins = 0;
-    for (int i = 0; i < spins; i++) {
-        slot.buffer = SlotBuffer::generate(slot.reels, slot.rows, slot.weights);
-        Money win = calculate_win();
-        if (!win) no_wins++;
-        total += win;
-    }
-    this->ev = double(total) / spins;
-    this->win_percent = double(spins - no_wins) / double(spins);
-}
-
-// --- M1X1 ---------------------------------------------------
-
-struct M1X1 : SlotMachine {
-    std::vector<float> payouts = {};
-
-    M1X1() {
-        this->stake   = 10;
-
-        slot.machine = this;
-        slot.reels   = 1;
-        slot.rows    = 1;
-        slot.speed   = 1000;
-        slot.spin_distance = 20;
-        payouts = { 0, 3, 7, 15, 20 };
-        slot.weights = { {0, 23}, {1,7}, {2,5}, {3,3}, {4,2} };
-        texture = tex_m1x1;
-        slot.tick_rate = 0.15;
-
-        slot.tiles = {
-            { .id = 0, .texture = tex_tile_dot },
-            { .id = 1, .texture = tex_tile_orange },
-            { .id = 2, .texture = tex_tile_cherry },
-            { .id = 3, .texture = tex_tile_7 },
-            { .id = 4, .texture = tex_tile_k },
-            { .id = 4, .texture = tex_tile_k },
-        };
+// call once per frame
+void sweep_text_cache() {
+    text_frame++;
+    if (text_cache.size() <= TEXT_CACHE_MAX) return;
+    std::erase_if(text_cache, [](const auto& entry) {
+        return text_frame - entry.second.last_used > TEXT_CACHE_STALE;
+    });
+}
 
-        calculate_ev();
-        printf("Spawned M1X1 (RTP: %.2f%%, Win Chance: %.2f%%)\n", ev*100, win_percent*100);
+// --- Pack ---------------------------------------------------
+// All assets in one file next to the executable, written by --pack at build
+// time: pictures as raw RGBA8, sounds as raw PCM, music as the original file
+// since it gets streamed anyway. The file is mapped and raylib reads straight
+// out of the mapping. Without a valid pack the loose files in assets/ load.
+
+#define PACK_MAGIC   0x4B505839 // "9XPK"
+#define PACK_VERSION 1
+#define PACK_FILE    "assets.pak"
+#define PACK_ALIGN   16
+
+enum PackKind : u32 {
+    PACK_PICTURE,
+    PACK_SOUND,
+    PACK_RAW,
+};
 
-        slot.buffer = SlotBuffer::generate(slot.reels, slot.rows, slot.weights);
-    }
+struct PackHeader {
+    u32 magic;
+    u32 version;
+    u32 entry_count;
+    u32 reserved;
+};
 
-    virtual Money calculate_win() override {
-        return payouts[slot.buffer.at(0,0)] * stake;
-    }
+struct PackEntry {
+    char     path[48];    // the loose file it came from, "assets/tile_7.png"
+    PackKind kind;
+    u32      width;       // pictures
+    u32      height;
+    u32      frame_count; // sounds
+    u32      sample_rate;
+    u32      sample_size;
+    u32      channels;
+    u32      reserved;
+    u64      offset;
+    u64      size;
 };
 
-// -- M3X1 ----------------------------------------------------
+struct Pack {
+    const u8*        data    = nullptr;
+    size_t           size    = 0;
+    const PackEntry* entries = nullptr;
+    u32              count   = 0;
+};
 
-struct M3X1 : SlotMachine {
-    bool anticipation = false;
-    std::vector<float> payouts = {};
+Pack pack;
+
+const u8* map_file(const char* path, size_t* size) {
+#ifdef _WIN32
+    int bytes = 0;
+    u8* data = LoadFileData(path, &bytes);
+    *size = bytes;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) return nullptr;
+    *size = info.st_size;
+    return (const u8*)data;
+#endif
+}
 
-    M3X1() {
-        this->stake = 10;
+void unmap_file(const u8* data, size_t size) {
+#ifdef _WIN32
+    UnloadFileData((u8*)data);
+#else
+    munmap((void*)data, size);
+#endif
+}
 
-        slot.reels   = 3;
-        slot.rows    = 1;
-        slot.speed   = 800;
-        slot.spin_distance = 20;
-        slot.spin_distance_per_reel = 4;
-        slot.reel_offset_time = 0.2;
-        texture = tex_m3x1;
-        payouts = { 20, 100, 200, 5000 };
-        slot.weights = {{0,10}, {1,5}, {2,3}, {3,1}};
-        slot.tick_rate = 0.15;
+// raylib reads width * height pixels or frame_count frames straight out of
+// the mapping, so those have to add up to exactly the bytes the entry has
+bool pack_entry_valid(const PackEntry& entry, size_t size) {
+    if (entry.offset > size || entry.size > size - entry.offset) return false;
+    switch (entry.kind) {
+        case PACK_PICTURE:
+            return entry.size == u64(entry.width) * entry.height * 4;
+        case PACK_SOUND:
+            return (entry.sample_size == 8 || entry.sample_size == 16 || entry.sample_size == 32) &&
+                   entry.size == u64(entry.frame_count) * entry.channels * (entry.sample_size / 8);
+        case PACK_RAW:
+            return true;
+    }
+    return false;
+}
 
-        slot.tiles = {
-            { .id = 0, .texture = tex_tile_orange  },
-            { .id = 1, .texture = tex_tile_cherry  },
-            { .id = 2, .texture = tex_tile_7 },
-            { .id = 3, .texture = tex_tile_777  },
-        };
+void pack_open(const char* path) {
+    size_t size = 0;
+    const u8* data = map_file(path, &size);
+    if (!data) return;
 
-        calculate_ev();
-        printf("Spawned M3X1 (RTP: %.2f%%, Win Chance: %.2f%%)\n", ev*100, win_percent*100);
+    const PackHeader* header = (const PackHeader*)data;
+    bool valid = size >= sizeof(PackHeader) &&
+                 header->magic == PACK_MAGIC &&
+                 header->version == PACK_VERSION &&
+                 sizeof(PackHeader) + u64(header->entry_count) * sizeof(PackEntry) <= size;
 
-        slot.buffer = SlotBuffer::generate(slot.reels, slot.rows, slot.weights);
-    }
+    const PackEntry* entries = (const PackEntry*)(data + sizeof(PackHeader));
+    for (u32 i = 0; valid && i < header->entry_count; i++)
+        valid = pack_entry_valid(entries[i], size);
 
-    virtual Money calculate_win() override {
-        Money win = 0;
-        if (slot.buffer.at(0,0) == slot.buffer.at(1,0) && slot.buffer.at(1,0) == slot.buffer.at(2,0)) {
-            return payouts[slot.buffer.at(0,0)] * this->stake;
-        }
-        else {
-            return 0;
-        }
+    if (!valid) {
+        fprintf(stderr, "%s is not a valid pack, loading loose files\n", path);
+        unmap_file(data, size);
+        return;
     }
 
-    virtual void on_reel_stop(int reel) override {
-        if (reel == 1 && slot.buffer.at(0,0) == slot.buffer.at(1,0)) {
-            slot.current_spin_distance += 20;
-            anticipation = true;
-            if (msc_anticipation_count == 0) PlayMusicStream(msc_anticipation);
-            msc_anticipation_count++;
-        }
-    }
+    pack = { data, size, entries, header->entry_count };
+}
 
-    virtual void on_stop() override {
+const PackEntry* pack_find(const char* path) {
+    for (u32 i = 0; i < pack.count; i++)
+        if (!strncmp(pack.entries[i].path, path, sizeof(pack.entries[i].path)))
+            return &pack.entries[i];
+    return nullptr;
+}
+
+Image pack_image(const PackEntry* entry) {
+    return { (void*)(pack.data + entry->offset), int(entry->width), int(entry->height), 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+}
+
+Wave pack_wave(const PackEntry* entry) {
+    return { entry->frame_count, entry->sample_rate, entry->sample_size, entry->channels, (void*)(pack.data + entry->offset) };
+}
+
+Music load_music(const char* path) {
+    if (const PackEntry* entry = pack_find(path))
+        return LoadMusicStreamFromMemory(GetFileExtension(path), pack.data + entry->offset, entry->size);
+    return LoadMusicStream(path);
+}
+
+// --- Loader -------------------------------------------------
+// Worker threads decode pictures and sounds while the main thread keeps
+// drawing a loading bar. Everything that talks to the GPU or the audio device
+// stays on the main thread and gets a time budget per frame: decoded sounds
+// become voices as they arrive, pictures get packed once all are in and then
+// uploaded into the atlas a few at a time.
+
+#define MAX_LOAD_JOBS  64
+#define LOADER_BUDGET  0.004 // seconds of main thread work per loading frame
+
+struct LoadJob {
+    const char*       path     = nullptr;
+    Sprite*           sprite   = nullptr; // pictures go into the atlas
+    SoundDef*         sound    = nullptr; // sounds into the voice pool
+    Image             image    = {};
+    Wave              wave     = {};
+    bool              owned    = true;    // false when it points into the pack
+    std::atomic<bool> decoded  = false;
+    bool              finished = false;   // handed to raylib, main thread only
+};
+
+struct Loader {
+    LoadJob                  jobs[MAX_LOAD_JOBS];
+    int                      job_count = 0;
+    std::atomic<int>         next_job  = 0;
+    std::vector<std::thread> workers;
+    int                      sounds_left  = 0;
+    bool                     atlas_packed = false;
+    int                      uploaded    = 0; // atlas pictures, the white patch and the font included
+};
+
+Loader loader;
+
+void load_picture(const char* path, Sprite* sprite) {
+    assert(loader.job_count < MAX_LOAD_JOBS);
+    LoadJob& job = loader.jobs[loader.job_count++];
+    job.path = path;
+    job.sprite = sprite;
+}
+
+void load_sound(SoundDef* sound) {
+    assert(loader.job_count < MAX_LOAD_JOBS);
+    LoadJob& job = loader.jobs[loader.job_count++];
+    job.path = sound->path;
+    job.sound = sound;
+    loader.sounds_left++;
+}
+
+struct PictureAsset {
+    const char* path;
+    Sprite*     sprite;
+};
+
+PictureAsset picture_assets[] = {
+    { "assets/background.png",  &spr_background  },
+    { "assets/m1x1.png",        &spr_m1x1        },
+    { "assets/m3x1.png",        &spr_m3x1        },
+    { "assets/mb5.png",         &spr_mb5         },
+
+    { "assets/tile_0.png",      &spr_tile_0      },
+    { "assets/tile_dot.png",    &spr_tile_dot    },
+    { "assets/tile_cherry.png", &spr_tile_cherry },
+    { "assets/tile_orange.png", &spr_tile_orange },
+    { "assets/tile_7.png",      &spr_tile_7      },
+    { "assets/tile_777.png",    &spr_tile_777    },
+
+    { "assets/tile_9.png",      &spr_tile_9      },
+    { "assets/tile_10.png",     &spr_tile_10     },
+    { "assets/tile_j.png",      &spr_tile_j      },
+    { "assets/tile_q.png",      &spr_tile_q      },
+    { "assets/tile_k.png",      &spr_tile_k      },
+};
+
+const char* music_assets[] = {
+    "assets/police.wav",
+    "assets/anticipation.wav",
+};
+
+// ./9XGAMBLER --pack <file>, run from the source directory
+int write_pack(const char* path) {
+    std::vector<PackEntry> entries;
+    std::vector<u8> blob;
+
+    auto add = [&](const char* asset, PackKind kind, const void* data, u64 size) -> PackEntry& {
+        PackEntry& entry = entries.emplace_back();
+        assert(strlen(asset) < sizeof(entry.path));
+        strncpy(entry.path, asset, sizeof(entry.path) - 1);
+        entry.kind = kind;
+        entry.offset = blob.size();
+        entry.size = size;
+        blob.insert(blob.end(), (const u8*)data, (const u8*)data + size);
+        blob.resize((blob.size() + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN);
+        return entry;
+    };
+
+    for (PictureAsset& asset : picture_assets) {
+        Image image = LoadImage(asset.path);
+        if (!image.data) {
+            fprintf(stderr, "Can't read %s\n", asset.path);
+            return 1;
+        }
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        PackEntry& entry = add(asset.path, PACK_PICTURE, image.data, u64(image.width) * image.height * 4);
+        entry.width = image.width;
+        entry.height = image.height;
+        UnloadImage(image);
+    }
+
+    for (SoundDef& def : sounds) {
+        Wave wave = LoadWave(def.path);
+        if (!wave.data) {
+            fprintf(stderr, "Can't read %s\n", def.path);
+            return 1;
+        }
+        PackEntry& entry = add(def.path, PACK_SOUND, wave.data, u64(wave.frameCount) * wave.channels * wave.sampleSize / 8);
+        entry.frame_count = wave.frameCount;
+        entry.sample_rate = wave.sampleRate;
+        entry.sample_size = wave.sampleSize;
+        entry.channels = wave.channels;
+        UnloadWave(wave);
+    }
+
+    for (const char* asset : music_assets) {
+        int size = 0;
+        u8* data = LoadFileData(asset, &size);
+        if (!data) {
+            fprintf(stderr, "Can't read %s\n", asset);
+            return 1;
+        }
+        add(asset, PACK_RAW, data, size);
+        UnloadFileData(data);
+    }
+
+    u64 base = sizeof(PackHeader) + entries.size() * sizeof(PackEntry);
+    base = (base + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+    for (PackEntry& entry : entries)
+        entry.offset += base;
+
+    PackHeader header = { PACK_MAGIC, PACK_VERSION, u32(entries.size()), 0 };
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Can't write %s\n", path);
+        return 1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(entries.data(), sizeof(PackEntry), entries.size(), file);
+    for (u64 i = sizeof(header) + entries.size() * sizeof(PackEntry); i < base; i++)
+        fputc(0, file);
+    fwrite(blob.data(), 1, blob.size(), file);
+    fclose(file);
+
+    printf("Packed %d assets into %s (%.1f MB)\n", int(entries.size()), path, (base + blob.size()) / 1e6);
+    return 0;
+}
+
+void loader_worker() {
+    while (true) {
+        int i = loader.next_job.fetch_add(1);
+        if (i >= loader.job_count) return;
+
+        LoadJob& job = loader.jobs[i];
+        const PackEntry* entry = pack_find(job.path);
+        job.owned = !entry;
+
+        if (job.sprite && entry) {
+            job.image = pack_image(entry);
+        }
+        else if (job.sprite) {
+            job.image = LoadImage(job.path);
+            ImageFormat(&job.image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        }
+        else if (entry) {
+            job.wave = pack_wave(entry);
+        }
+        else {
+            job.wave = LoadWave(job.path);
+        }
+        job.decoded.store(true, std::memory_order_release);
+    }
+}
+
+void loader_start() {
+    int threads = std::clamp(int(std::thread::hardware_concurrency()), 1, loader.job_count);
+    for (int i = 0; i < threads; i++)
+        loader.workers.emplace_back(loader_worker);
+}
+
+void loader_join() {
+    for (std::thread& worker : loader.workers)
+        worker.join();
+    loader.workers.clear();
+}
+
+// half decoding, half handing things to raylib
+float loader_progress() {
+    int steps = loader.uploaded;
+    for (int i = 0; i < loader.job_count; i++) {
+        steps += loader.jobs[i].decoded.load(std::memory_order_relaxed);
+        steps += loader.jobs[i].sound && loader.jobs[i].finished;
+    }
+    return loader.job_count ? std::min(1.0f, steps / (2.0f * loader.job_count)) : 1;
+}
+
+void finish_sound(LoadJob& job) {
+    SoundDef& def = *job.sound;
+    def.source = LoadSoundFromWave(job.wave);
+    for (Sound& alias : def.aliases)
+        alias = LoadSoundAlias(def.source);
+    if (job.owned) UnloadWave(job.wave);
+}
+
+// Does at most budget seconds of main thread work, true once everything's loaded
+bool loader_update(double budget) {
+    double start = GetTime();
+    auto out_of_time = [&]() { return GetTime() - start > budget; };
+
+    for (int i = 0; i < loader.job_count; i++) {
+        LoadJob& job = loader.jobs[i];
+        if (!job.sound || job.finished || !job.decoded.load(std::memory_order_acquire)) continue;
+
+        finish_sound(job);
+        job.finished = true;
+        loader.sounds_left--;
+        if (out_of_time()) return false;
+    }
+
+    if (!loader.atlas_packed) {
+        for (int i = 0; i < loader.job_count; i++) {
+            LoadJob& job = loader.jobs[i];
+            if (job.sprite && !job.decoded.load(std::memory_order_acquire)) return false;
+        }
+        for (int i = 0; i < loader.job_count; i++)
+            if (loader.jobs[i].sprite) atlas_add(loader.jobs[i].image, loader.jobs[i].sprite, loader.jobs[i].owned);
+        atlas_pack();
+        loader.atlas_packed = true;
+        if (out_of_time()) return false;
+    }
+
+    while (loader.uploaded < int(atlas_images.size())) {
+        atlas_upload(loader.uploaded++);
+        if (out_of_time()) return false;
+    }
+
+    if (loader.sounds_left > 0) return false;
+
+    loader_join();
+    atlas_finish();
+    build_glyphs();
+    return true;
+}
+
+// --- Draw stats ---------------------------------------------
+// rlgl submits every batch through glad's function pointers, so wrapping
+// them once the context exists counts real draw calls.
+
+extern "C" {
+    extern void (*glad_glDrawElements)(unsigned int mode, int count, unsigned int type, const void* indices);
+    extern void (*glad_glDrawArrays)(unsigned int mode, int first, int count);
+}
+
+struct DrawStats {
+    int draw_calls = 0;
+    int last_draw_calls = 0; // what the previous frame ended with
+    u64 allocations_at_frame_start = 0;
+    u64 last_allocations = 0;
+};
+
+DrawStats draw_stats;
+void (*gl_draw_elements)(unsigned int, int, unsigned int, const void*) = nullptr;
+void (*gl_draw_arrays)(unsigned int, int, int) = nullptr;
+
+void count_draw_calls() {
+    gl_draw_elements = glad_glDrawElements;
+    gl_draw_arrays = glad_glDrawArrays;
+
+    glad_glDrawElements = [](unsigned int mode, int count, unsigned int type, const void* indices) {
+        draw_stats.draw_calls++;
+        gl_draw_elements(mode, count, type, indices);
+    };
+    glad_glDrawArrays = [](unsigned int mode, int first, int count) {
+        draw_stats.draw_calls++;
+        gl_draw_arrays(mode, first, count);
+    };
+}
+
+// Debug builds send every heap allocation in the process through here, so
+// the overlay can show how many a frame costs. Release builds count none.
+std::atomic<u64> allocation_count = 0;
+
+#ifndef NDEBUG
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+// the pair is malloc/free underneath, GCC only sees the new expression
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+#pragma GCC diagnostic pop
+#endif
+
+// call right after EndDrawing()
+void end_frame_stats() {
+    draw_stats.last_draw_calls = draw_stats.draw_calls;
+    draw_stats.draw_calls = 0;
+
+    u64 allocations = allocation_count.load(std::memory_order_relaxed);
+    draw_stats.last_allocations = allocations - draw_stats.allocations_at_frame_start;
+    draw_stats.allocations_at_frame_start = allocations;
+}
+
+// --- Profiler -----------------------------------------------
+// PROFILE_SCOPE(PROF_X) times the rest of the block. Each frame sums the
+// time per scope into a ring of the last PROFILE_FRAMES frames for the F3
+// overlay. Every single scope also lands in a ring of PROFILE_EVENTS, and F4
+// dumps those as a Chrome trace (chrome://tracing or ui.perfetto.dev).
+// Release builds (NDEBUG) compile all of it out.
+
+enum ProfileId {
+    PROF_FRAME,
+    PROF_SIM_MACHINES,
+    PROF_SIM_TIMERS,
+    PROF_SIM_TEXTS,
+    PROF_RENDER_MACHINES,
+    PROF_RENDER_SHOP,
+    PROF_RENDER_TEXTS,
+    PROF_HUD,
+    PROF_AUDIO,
+    PROF_COUNT,
+};
+
+#ifdef NDEBUG
+
+#define PROFILE_SCOPE(id)
+
+#else
+
+#define PROFILE_FRAMES 240
+#define PROFILE_EVENTS 16384
+#define PROFILE_TRACE  "9xgambler_trace.json"
+
+const char* profile_names[PROF_COUNT] = {
+    "Frame", "Sim machines", "Sim timers", "Sim texts", "Render machines", "Render shop", "Render texts", "HUD", "Audio",
+};
+
+struct ProfileEvent {
+    u64 start;    // ns since the profiler started
+    u32 duration; // ns
+    u8  id;
+};
+
+struct Profiler {
+    bool         enabled = false; // off headless, a clock read per step would double its cost
+    u64          epoch = 0;
+    u64          frame_start = 0;
+    u64          current[PROF_COUNT] = {};           // ns so far this frame
+    float        frames[PROFILE_FRAMES][PROF_COUNT]; // ms per finished frame
+    int          frame = 0;                          // next slot in frames
+    int          frame_count = 0;
+    ProfileEvent events[PROFILE_EVENTS];
+    u64          event_count = 0;
+};
+
+Profiler profiler;
+
+u64 profile_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void profile_add(int id, u64 start, u64 end) {
+    profiler.current[id] += end - start;
+    profiler.events[profiler.event_count++ % PROFILE_EVENTS] = {
+        .start    = start - profiler.epoch,
+        .duration = u32(end - start),
+        .id       = u8(id),
+    };
+}
+
+struct ProfileScope {
+    int id;
+    u64 start;
+
+    ProfileScope(int id) : id(id), start(profiler.enabled ? profile_now() : 0) {}
+    ~ProfileScope() { if (profiler.enabled) profile_add(id, start, profile_now()); }
+};
+
+#define PROFILE_CONCAT(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_CONCAT(profile_scope_, line)
+#define PROFILE_SCOPE(id) ProfileScope PROFILE_NAME(__LINE__)(id)
+
+void profile_start() {
+    profiler.enabled = true;
+    profiler.epoch = profiler.frame_start = profile_now();
+}
+
+// call right after EndDrawing(), so a frame includes waiting for the swap
+void profile_end_frame() {
+    u64 now = profile_now();
+    profile_add(PROF_FRAME, profiler.frame_start, now);
+    profiler.frame_start = now;
+
+    for (int id = 0; id < PROF_COUNT; id++) {
+        profiler.frames[profiler.frame][id] = profiler.current[id] / 1e6f;
+        profiler.current[id] = 0;
+    }
+    profiler.frame = (profiler.frame + 1) % PROFILE_FRAMES;
+    profiler.frame_count = std::min(profiler.frame_count + 1, PROFILE_FRAMES);
+}
+
+float profile_percentile(int id, float percentile) {
+    float values[PROFILE_FRAMES];
+    int count = profiler.frame_count;
+    if (count == 0) return 0;
+
+    for (int i = 0; i < count; i++) values[i] = profiler.frames[i][id];
+    int nth = std::min(int(count * percentile), count - 1);
+    std::nth_element(values, values + nth, values + count);
+    return values[nth];
+}
+
+// frame times as bars, 60fps is the line, then p50/p99 of every scope
+void draw_profiler(float x, float y) {
+    const float graph_height = 60;
+    const float ms_to_px = graph_height / (2 * 1000.0f / 60); // 33ms fills the graph
+    float width = 340;
+
+    DrawRectangle(x, y, width, graph_height + 16 + (PROF_COUNT + 1) * 20 + 8, Color{0,0,0,160});
+    for (int i = 0; i < profiler.frame_count; i++) {
+        // oldest on the left
+        int frame = (profiler.frame - profiler.frame_count + i + PROFILE_FRAMES) % PROFILE_FRAMES;
+        float ms = profiler.frames[frame][PROF_FRAME];
+        float h = std::min(ms * ms_to_px, graph_height);
+        DrawRectangle(x + 8 + i, y + 8 + graph_height - h, 1, h, ms > 1000.0f / 60 ? RED : GREEN);
+    }
+    DrawRectangle(x + 8, y + 8 + graph_height - 1000.0f / 60 * ms_to_px, PROFILE_FRAMES, 1, WHITE);
+
+    static Label labels[PROF_COUNT];
+    y += graph_height + 16;
+    draw_text("ms p50 / p99", x + 180, y, 20, GRAY);
+    y += 20;
+    for (int id = 0; id < PROF_COUNT; id++) {
+        // hundredths of a ms is all the label shows, no need to format more often
+        i64 p50 = llround(profile_percentile(id, 0.5f) * 100);
+        i64 p99 = llround(profile_percentile(id, 0.99f) * 100);
+        draw_text(profile_names[id], x + 8, y, 20, WHITE);
+        draw_text(labels[id].format(p50 << 32 | p99, "%.2f / %.2f", p50 / 100.0, p99 / 100.0), x + 180, y, 20, WHITE);
+        y += 20;
+    }
+}
+
+bool write_trace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+
+    u64 count = std::min<u64>(profiler.event_count, PROFILE_EVENTS);
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (u64 i = 0; i < count; i++) {
+        const ProfileEvent& event = profiler.events[(profiler.event_count - count + i) % PROFILE_EVENTS];
+        fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":0}%s\n",
+                profile_names[event.id], event.start / 1e3, event.duration / 1e3, i + 1 < count ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    return fclose(file) == 0;
+}
+
+#endif
+
+// --- Odds ---------------------------------------------------
+// Closed form win chances for the paytables we have, so buying a machine
+// doesn't need to spin it 100k times. simulate() is the cross-check.
+
+// chance of every tile id, ids index into the paytable
+std::vector<double> tile_chances(Weights<int>& weights, int tile_count) {
+    std::vector<double> p(tile_count);
+    for (auto& entry : weights.entries)
+        p[entry.first] += double(entry.second) / weights.total;
+    return p;
+}
+
+Money payout(const std::vector<float>& payouts, int tile, Money stake) {
+    return payouts[tile] * stake;
+}
+
+// one tile decides the win
+Odds odds_single(Weights<int>& weights, const std::vector<float>& payouts, Money stake) {
+    std::vector<double> p = tile_chances(weights, payouts.size());
+    Odds odds;
+    double ev_sq = 0;
+    for (int tile = 0; tile < int(payouts.size()); tile++) {
+        Money win = payout(payouts, tile, stake);
+        odds.ev += p[tile] * win;
+        ev_sq += p[tile] * win * win;
+        if (win) odds.win_chance += p[tile];
+    }
+    odds.variance = ev_sq - odds.ev * odds.ev;
+    return odds;
+}
+
+// every reel has to show the same tile
+Odds odds_match_all(Weights<int>& weights, const std::vector<float>& payouts, int reels, Money stake) {
+    std::vector<double> p = tile_chances(weights, payouts.size());
+    Odds odds;
+    double ev_sq = 0;
+    for (int tile = 0; tile < int(payouts.size()); tile++) {
+        Money win = payout(payouts, tile, stake);
+        double chance = pow(p[tile], reels);
+        odds.ev += chance * win;
+        ev_sq += chance * win * win;
+        if (win) odds.win_chance += chance;
+    }
+    odds.variance = ev_sq - odds.ev * odds.ev;
+    return odds;
+}
+
+// every tile that shows up n or more times anywhere in the grid pays
+Odds odds_n_of_a_kind(Weights<int>& weights, const std::vector<float>& payouts, int cells, int n, Money stake) {
+    std::vector<double> p = tile_chances(weights, payouts.size());
+
+    // binomial pmf of a tile with chance q showing up k times in the grid
+    auto binomial = [&](double q, int k) {
+        return exp(lgamma(cells + 1) - lgamma(k + 1) - lgamma(cells - k + 1)) * pow(q, k) * pow(1 - q, cells - k);
+    };
+
+    // chance of two tiles both showing up n or more times
+    auto both = [&](double q, double r) {
+        double chance = 0;
+        for (int a = n; a <= cells; a++)
+            for (int b = n; a + b <= cells; b++)
+                chance += exp(lgamma(cells + 1) - lgamma(a + 1) - lgamma(b + 1) - lgamma(cells - a - b + 1))
+                        * pow(q, a) * pow(r, b) * pow(1 - q - r, cells - a - b);
+        return chance;
+    };
+
+    Odds odds;
+    double ev_sq = 0;
+    double losing_tiles = 0; // tiles that pay nothing, any count is fine
+
+    // no_win[k] = sum over ways to place k cells of paying tiles, each with < n copies,
+    // of prod(p^c / c!). Multiplying by cells! turns it back into a multinomial.
+    std::vector<double> no_win(cells + 1);
+    no_win[0] = 1;
+
+    for (int tile = 0; tile < int(payouts.size()); tile++) {
+        Money win = payout(payouts, tile, stake);
+        if (!win) {
+            losing_tiles += p[tile];
+            continue;
+        }
+
+        double hit = 0;
+        for (int k = n; k <= cells; k++)
+            hit += binomial(p[tile], k);
+        odds.ev += hit * win;
+        ev_sq += hit * win * win;
+
+        for (int other = 0; other < tile; other++)
+            ev_sq += 2 * both(p[tile], p[other]) * win * payout(payouts, other, stake);
+
+        std::vector<double> next(cells + 1);
+        for (int used = 0; used <= cells; used++)
+            for (int c = 0; c < n && used + c <= cells; c++)
+                next[used + c] += no_win[used] * pow(p[tile], c) / tgamma(c + 1);
+        no_win = next;
+    }
+
+    double lose = 0;
+    for (int used = 0; used <= cells; used++)
+        lose += no_win[used] * pow(losing_tiles, cells - used) / tgamma(cells - used + 1);
+    lose *= tgamma(cells + 1);
+
+    odds.win_chance = 1 - lose;
+    odds.variance = ev_sq - odds.ev * odds.ev;
+    return odds;
+}
+
+// --- Paytables ----------------------------------------------
+// Scoring for grids that pay on how often a tile shows up anywhere. One pass
+// counts the tiles and a flat [tile][count] table says what each count pays,
+// so nothing branches on the grid and it's never scanned once per tile.
+
+#define MAX_SLOT_TILES 32
+#define MAX_SLOT_CELLS (MAX_SLOT_REELS * MAX_SLOT_ROWS)
+
+struct CountPaytable {
+    int tiles  = 0;
+    int stride = 0;           // cells + 1, every count a grid can have
+    std::vector<Money> table; // tiles * stride
+
+    void reset(int tiles, int cells) {
+        assert(tiles <= MAX_SLOT_TILES && cells <= MAX_SLOT_CELLS);
+        this->tiles = tiles;
+        stride = cells + 1;
+        table.assign(tiles * stride, 0);
+    }
+
+    // every tile showing up n or more times pays its payout
+    void build_n_of_a_kind(const std::vector<float>& payouts, int cells, int n, Money stake) {
+        reset(payouts.size(), cells);
+        for (int tile = 0; tile < tiles; tile++)
+            for (int count = n; count < stride; count++)
+                table[tile * stride + count] = payout(payouts, tile, stake);
+    }
+
+    // every copy of a tile pays its payout, once there are n or more of them
+    void build_scatter(const std::vector<float>& payouts, int cells, int n, Money stake) {
+        reset(payouts.size(), cells);
+        for (int tile = 0; tile < tiles; tile++)
+            for (int count = n; count < stride; count++)
+                table[tile * stride + count] = payout(payouts, tile, stake) * count;
+    }
+};
+
+// --- Machine definitions ------------------------------------
+// Everything that makes one slot machine different from another. The
+// built-in ones are constexpr, so their evaluator gets compiled for exactly
+// their grid and rule. --machines <file> adds more at startup and those go
+// through the same evaluator with the definition read at runtime.
+
+#define MAX_PAYLINES          16
+#define BUILTIN_MACHINE_TYPES 4 // None and the three below
+#define MACHINE_TYPE_LIMIT    (MAX_MACHINE_TYPES - 3) // every type is in the saved shop catalog, next to 3 upgrades
+
+enum class WinRule : u8 {
+    Single,   // the one tile pays
+    MatchAll, // the top row of every reel shows the same tile
+    NOfAKind, // every tile showing up n or more times anywhere
+    Paylines, // every line with the same tile on every reel
+    Scatter,  // every copy of a tile, once there are n or more anywhere
+};
+
+struct TileDef {
+    int     weight = 0;
+    float   payout = 0;        // times the stake
+    Sprite* sprite = nullptr;
+};
+
+struct MachineDef {
+    const char* id          = "";      // for logs and benchmarks
+    const char* name        = "";      // in the shop
+    const char* tagline     = "";
+    Sprite*     sprite      = nullptr;
+    Money       price       = 500;
+    int         shop_weight = 1;
+    Money       stake       = 10;
+
+    int       reels                  = 1;
+    int       rows                   = 1;
+    float     speed                  = 800;
+    int       spin_distance          = 20;
+    int       spin_distance_per_reel = 3;
+    float     reel_offset_time       = 0.1;
+    double    tick_rate              = 0.15;
+    Rectangle slot_rect              = { 10, 60, 164, 86 }; // from the machine's corner
+
+    WinRule rule              = WinRule::Single;
+    int     n                 = 0; // for NOfAKind and Scatter
+    int     tile_count        = 0;
+    TileDef tiles[MAX_SLOT_TILES] = {};
+    int     payline_count     = 0;
+    i8      paylines[MAX_PAYLINES][MAX_SLOT_REELS] = {}; // the row on each reel
+    u8      payline_lengths[MAX_PAYLINES] = {};          // how many rows each line gave
+
+    int  anticipation_rows = 0;     // MatchAll: the last reel goes this much further when the others match
+    bool restart_auto_spin = false; // auto spin counts from when the reels stop, not from the click
+
+    Odds odds = {}; // Paylines and Scatter at stake, sampled by load_machine_defs
+};
+
+// What a grid wins under def's rule. pay is each tile's payout at the stake,
+// counts the CountPaytable for NOfAKind and Scatter. With a constexpr def the
+// switch and the loop bounds fold away, see FixedMachine.
+inline Money evaluate(const MachineDef& def, const SlotBuffer& buffer, const Money* pay, const Money* counts) {
+    switch (def.rule) {
+        case WinRule::Single:
+            return pay[buffer.at(0, 0)];
+
+        case WinRule::MatchAll: {
+            int tile = buffer.at(0, 0);
+            bool match = true;
+            for (int reel = 1; reel < def.reels; reel++)
+                match &= buffer.at(reel, 0) == tile;
+            return match ? pay[tile] : 0;
+        }
+
+        case WinRule::Paylines: {
+            Money win = 0;
+            for (int line = 0; line < def.payline_count; line++) {
+                int tile = buffer.at(0, def.paylines[line][0]);
+                bool match = true;
+                for (int reel = 1; reel < def.reels; reel++)
+                    match &= buffer.at(reel, def.paylines[line][reel]) == tile;
+                win += match ? pay[tile] : 0;
+            }
+            return win;
+        }
+
+        case WinRule::NOfAKind:
+        case WinRule::Scatter: {
+            u8 histogram[MAX_SLOT_TILES] = {};
+            for (int reel = 0; reel < def.reels; reel++)
+                for (int row = 0; row < def.rows; row++)
+                    histogram[buffer.at(reel, row)]++;
+
+            Money win = 0;
+            int stride = def.reels * def.rows + 1;
+            for (int tile = 0; tile < def.tile_count; tile++)
+                win += counts[tile * stride + histogram[tile]];
+            return win;
+        }
+    }
+    return 0;
+}
+
+constexpr MachineDef m1x1_def = {
+    .id = "M1X1", .name = "1X1", .tagline = "Baby's first slot machine. Low Volatility",
+    .sprite = &spr_m1x1, .price = 500, .shop_weight = 8, .stake = 10,
+    .reels = 1, .rows = 1, .speed = 1000, .spin_distance = 20,
+    .rule = WinRule::Single,
+    .tile_count = 5,
+    .tiles = {
+        { 23, 0,  &spr_tile_dot    },
+        { 7,  3,  &spr_tile_orange },
+        { 5,  7,  &spr_tile_cherry },
+        { 3,  15, &spr_tile_7      },
+        { 2,  20, &spr_tile_k      },
+    },
+};
+
+constexpr MachineDef m3x1_def = {
+    .id = "M3X1", .name = "3X1", .tagline = "Match 3 to win. Medium Volatility",
+    .sprite = &spr_m3x1, .price = 500, .shop_weight = 4, .stake = 10,
+    .reels = 3, .rows = 1, .speed = 800, .spin_distance = 20, .spin_distance_per_reel = 4, .reel_offset_time = 0.2,
+    .rule = WinRule::MatchAll,
+    .tile_count = 4,
+    .tiles = {
+        { 10, 20,   &spr_tile_orange },
+        { 5,  100,  &spr_tile_cherry },
+        { 3,  200,  &spr_tile_7      },
+        { 1,  5000, &spr_tile_777    },
+    },
+    .anticipation_rows = 20,
+    .restart_auto_spin = true,
+};
+
+constexpr MachineDef mb5_def = {
+    .id = "MB5", .name = "BLOODY 5", .tagline = "Get 5 of a kind to win. Medium Volatility",
+    .sprite = &spr_mb5, .price = 1000, .shop_weight = 3, .stake = 10,
+    .reels = 4, .rows = 3, .speed = 800, .spin_distance = 25, .spin_distance_per_reel = 4, .reel_offset_time = 0.1,
+    .slot_rect = { 5, 60, 184, 107 },
+    .rule = WinRule::NOfAKind, .n = 5,
+    .tile_count = 5,
+    .tiles = {
+        { 8, 0,    &spr_tile_dot    },
+        { 5, 20,   &spr_tile_orange },
+        { 3, 100,  &spr_tile_cherry },
+        { 2, 800,  &spr_tile_7      },
+        { 2, 1200, &spr_tile_777    },
+    },
+    .restart_auto_spin = true,
+};
+
+// indexed by MachineType
+const MachineDef* machine_defs[MAX_MACHINE_TYPES] = { nullptr, &m1x1_def, &m3x1_def, &mb5_def };
+int               machine_type_count = BUILTIN_MACHINE_TYPES;
+MachineDef        loaded_machine_defs[MAX_MACHINE_TYPES];
+
+const MachineDef* machine_def(MachineType type) {
+    return u8(type) < machine_type_count ? machine_defs[u8(type)] : nullptr;
+}
+
+// assets/<name>.png
+Sprite* find_sprite(const char* name) {
+    for (PictureAsset& asset : picture_assets)
+        if (!strcmp(asset.path, TextFormat("assets/%s.png", name)))
+            return asset.sprite;
+    return nullptr;
+}
+
+const char* check_machine_def(const MachineDef& def) {
+    if (!*def.name)                                              return "no name";
+    if (def.reels < 1 || def.reels > MAX_SLOT_REELS)             return "bad reel count";
+    if (def.rows < 1 || def.rows > MAX_SLOT_ROWS)                return "bad row count";
+    if (def.tile_count < 1)                                      return "no tiles";
+    if (def.speed <= 0 || def.stake <= 0 || def.shop_weight < 1) return "speed, stake and shop_weight have to be positive";
+    if (def.spin_distance < def.rows)                            return "the reels have to spin at least a screen";
+
+    u64 total = 0;
+    for (int tile = 0; tile < def.tile_count; tile++)
+        total += def.tiles[tile].weight;
+    if (total == 0) return "no tile has a weight";
+    if (total * def.tile_count >= (u64(1) << 32)) return "tile weights too large"; // see Weights::build
+
+    int cells = def.reels * def.rows;
+    switch (def.rule) {
+        case WinRule::MatchAll:
+            if (def.reels < 2) return "match_all needs two reels";
+            break;
+        case WinRule::NOfAKind:
+        case WinRule::Scatter:
+            if (def.n < 1 || def.n > cells) return "n has to fit in the grid";
+            break;
+        case WinRule::Paylines:
+            if (def.payline_count < 1) return "paylines without a line";
+            for (int line = 0; line < def.payline_count; line++) {
+                if (def.payline_lengths[line] != def.reels) return "line needs one row per reel";
+                for (int reel = 0; reel < def.reels; reel++)
+                    if (def.paylines[line][reel] < 0 || def.paylines[line][reel] >= def.rows) return "line outside the grid";
+            }
+            break;
+        default: break;
+    }
+    if (def.anticipation_rows && def.rule != WinRule::MatchAll) return "anticipation needs match_all";
+    return nullptr;
+}
+
+// --machines <file> adds the machines in it to the shop. One block each, # comments:
+//
+//   machine LINES 4                # the name in the shop starts a new machine
+//   tagline Four lines. High Volatility
+//   sprite mb5                     # assets/<name>.png, the art has to be packed already
+//   price 1500
+//   shop_weight 2                  # built-in ones are 8, 4 and 3
+//   stake 10
+//   grid 4 3                       # reels rows
+//   speed 800                      # pixels per second
+//   distance 25 4                  # rows the first reel spins, and how many more each next one
+//   reel_offset 0.1                # seconds between reels starting
+//   tick_rate 0.15
+//   slot_rect 5 60 184 107         # where the reels go on the art
+//   rule paylines                  # single, match_all, n_of_a_kind <n>, paylines, scatter <n>
+//   line 1 1 1 1                   # a payline, the row on each reel
+//   tile tile_cherry 3 100         # sprite, weight, payout times the stake
+//   anticipation 20                # match_all only: the last reel goes further when the others match
+//   restart_auto_spin              # auto spin counts from when the reels stop
+//
+// A replay or save with these machines needs the same file again.
+Odds simulate_def(const MachineDef& def);
+
+bool load_machine_defs(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Can't open machine definitions %s\n", path);
+        return false;
+    }
+
+    int first = machine_type_count;
+    int count = first;
+    MachineDef* def = nullptr;
+    const char* error = nullptr;
+    char line[512];
+    int line_number = 0;
+
+    auto finish = [&]() {
+        if (!def || error) return;
+        error = check_machine_def(*def);
+        if (!error) machine_defs[count++] = def;
+    };
+
+    while (!error && fgets(line, sizeof(line), file)) {
+        line_number++;
+        if (char* comment = strchr(line, '#')) *comment = 0;
+
+        char key[32];
+        int read = 0;
+        if (sscanf(line, " %31s %n", key, &read) != 1) continue;
+        char* rest = line + read;
+        rest[strcspn(rest, "\r\n")] = 0;
+        for (int i = strlen(rest); i > 0 && rest[i - 1] == ' '; i--) rest[i - 1] = 0;
+
+        if (!strcmp(key, "machine")) {
+            finish();
+            if (error) break;
+            if (count == MACHINE_TYPE_LIMIT) { error = "too many machines"; break; }
+            def = &loaded_machine_defs[count];
+            *def = MachineDef{};
+            def->id = def->name = strdup(rest);
+            continue;
+        }
+        if (!def) { error = "expected machine <name> first"; break; }
+
+        bool ok = true;
+        if      (!strcmp(key, "tagline"))     def->tagline = strdup(rest);
+        else if (!strcmp(key, "sprite"))      ok = (def->sprite = find_sprite(rest)) != nullptr;
+        else if (!strcmp(key, "price"))       ok = sscanf(rest, "%ld", &def->price) == 1;
+        else if (!strcmp(key, "shop_weight")) ok = sscanf(rest, "%d", &def->shop_weight) == 1;
+        else if (!strcmp(key, "stake"))       ok = sscanf(rest, "%ld", &def->stake) == 1;
+        else if (!strcmp(key, "grid"))        ok = sscanf(rest, "%d %d", &def->reels, &def->rows) == 2;
+        else if (!strcmp(key, "speed"))       ok = sscanf(rest, "%f", &def->speed) == 1;
+        else if (!strcmp(key, "distance"))    ok = sscanf(rest, "%d %d", &def->spin_distance, &def->spin_distance_per_reel) == 2;
+        else if (!strcmp(key, "reel_offset")) ok = sscanf(rest, "%f", &def->reel_offset_time) == 1;
+        else if (!strcmp(key, "tick_rate"))   ok = sscanf(rest, "%lf", &def->tick_rate) == 1;
+        else if (!strcmp(key, "anticipation")) ok = sscanf(rest, "%d", &def->anticipation_rows) == 1;
+        else if (!strcmp(key, "restart_auto_spin")) def->restart_auto_spin = true;
+        else if (!strcmp(key, "slot_rect")) {
+            Rectangle& r = def->slot_rect;
+            ok = sscanf(rest, "%f %f %f %f", &r.x, &r.y, &r.width, &r.height) == 4;
+        }
+        else if (!strcmp(key, "rule")) {
+            char rule[32];
+            ok = sscanf(rest, "%31s %d", rule, &def->n) >= 1;
+            if      (!strcmp(rule, "single"))      def->rule = WinRule::Single;
+            else if (!strcmp(rule, "match_all"))   def->rule = WinRule::MatchAll;
+            else if (!strcmp(rule, "n_of_a_kind")) def->rule = WinRule::NOfAKind;
+            else if (!strcmp(rule, "paylines"))    def->rule = WinRule::Paylines;
+            else if (!strcmp(rule, "scatter"))     def->rule = WinRule::Scatter;
+            else ok = false;
+        }
+        else if (!strcmp(key, "tile")) {
+            char sprite[64];
+            if (def->tile_count == MAX_SLOT_TILES) { error = "too many tiles"; break; }
+            TileDef& tile = def->tiles[def->tile_count++];
+            ok = sscanf(rest, "%63s %d %f", sprite, &tile.weight, &tile.payout) == 3 && tile.weight >= 0 &&
+                 (tile.sprite = find_sprite(sprite)) != nullptr;
+        }
+        else if (!strcmp(key, "line")) {
+            if (def->payline_count == MAX_PAYLINES) { error = "too many lines"; break; }
+            i8* rows = def->paylines[def->payline_count];
+            u8& length = def->payline_lengths[def->payline_count++];
+            char* p = rest;
+            for (; ok && *p; length++) {
+                char* end;
+                long row = strtol(p, &end, 10);
+                ok = length < MAX_SLOT_REELS && end != p && row >= 0 && row < MAX_SLOT_ROWS;
+                if (ok) rows[length] = row;
+                p = end + strspn(end, " \t");
+            }
+        }
+        else ok = false;
+
+        if (!ok) error = TextFormat("can't make sense of '%s %s'", key, rest);
+    }
+    finish();
+    fclose(file);
+
+    if (error) {
+        fprintf(stderr, "Can't load machine definitions %s, line %d: %s\n", path, line_number, error);
+        return false;
+    }
+    for (int type = first; type < count; type++) {
+        MachineDef* loaded = &loaded_machine_defs[type];
+        if (loaded->rule == WinRule::Paylines || loaded->rule == WinRule::Scatter)
+            loaded->odds = simulate_def(*loaded);
+    }
+    machine_type_count = count;
+    printf("Loaded %d machine definitions from %s\n", count - first, path);
+    return true;
+}
+
+// --- Scheduler ----------------------------------------------
+
+double Timer::time_left() {
+    return deadline - game_time;
+}
+
+void Scheduler::place(Timer* timer, int i) {
+    heap[i] = timer;
+    timer->heap_index = i;
+}
+
+void Scheduler::sift_up(int i) {
+    Timer* timer = heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (heap[parent]->deadline <= timer->deadline) break;
+        place(heap[parent], i);
+        i = parent;
+    }
+    place(timer, i);
+}
+
+void Scheduler::sift_down(int i) {
+    Timer* timer = heap[i];
+    int n = heap.size();
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && heap[child + 1]->deadline < heap[child]->deadline) child++;
+        if (timer->deadline <= heap[child]->deadline) break;
+        place(heap[child], i);
+        i = child;
+    }
+    place(timer, i);
+}
+
+void Scheduler::add(Timer* timer, double deadline) {
+    assert(timer->heap_index < 0);
+    timer->deadline = deadline;
+    heap.push_back(timer);
+    sift_up(heap.size() - 1);
+}
+
+void Scheduler::move(Timer* timer, double deadline) {
+    if (timer->heap_index < 0) {
+        add(timer, deadline);
+        return;
+    }
+    timer->deadline = deadline;
+    sift_up(timer->heap_index);
+    sift_down(timer->heap_index);
+}
+
+void Scheduler::remove(Timer* timer) {
+    int i = timer->heap_index;
+    if (i < 0) return;
+    timer->heap_index = -1;
+
+    Timer* last = heap.back();
+    heap.pop_back();
+    if (last == timer) return;
+
+    place(last, i);
+    sift_up(i);
+    sift_down(last->heap_index);
+}
+
+void Scheduler::run(double now) {
+    while (!heap.empty() && heap[0]->deadline <= now) {
+        Timer* timer = heap[0];
+        if (!timer->action()) {
+            remove(timer);
+            delete timer;
+        }
+        else if (timer->heap_index >= 0) {
+            assert(timer->deadline > now);
+            sift_down(timer->heap_index);
+        }
+    }
+}
+
+// The next timer is always a child of one already taken, so only the
+// children of taken timers are candidates.
+int Scheduler::peek(Timer** out, int k) {
+    int candidates[64];
+    int candidate_count = 0;
+    int found = 0;
+    assert(k < int(ARRAY_SIZE(candidates)));
+
+    if (!heap.empty()) candidates[candidate_count++] = 0;
+    while (found < k && candidate_count > 0) {
+        int best = 0;
+        for (int i = 1; i < candidate_count; i++)
+            if (heap[candidates[i]]->deadline < heap[candidates[best]]->deadline)
+                best = i;
+
+        int index = candidates[best];
+        candidates[best] = candidates[--candidate_count];
+        out[found++] = heap[index];
+
+        for (int child = 2 * index + 1; child <= 2 * index + 2 && child < int(heap.size()); child++)
+            candidates[candidate_count++] = child;
+    }
+    return found;
+}
+
+double Scheduler::next_deadline() {
+    return heap.empty() ? INFINITY : heap[0]->deadline;
+}
+
+void Scheduler::clear() {
+    for (Timer* timer : heap) {
+        timer->heap_index = -1;
+        delete timer;
+    }
+    heap.clear();
+}
+
+// --- Machine methods ----------------------------------------
+
+#define SHAKE_INTERVAL 0.02
+
+Machine::~Machine() {
+    events.remove(&shake_timer);
+}
+
+bool Timer_Shake::action() {
+    if (!machine->shaking()) {
+        events.remove(this);
+        return true;
+    }
+    machine->shake_x = fx_rng.range(-1, 1);
+    machine->shake_y = fx_rng.range(-2, 2);
+    deadline = game_time + SHAKE_INTERVAL;
+    return true;
+}
+
+// Nobody sees the shake with no window, so it's never scheduled there
+void Machine::start_shake() {
+    if (headless || shake_timer.heap_index >= 0 || !spot_visible(spot)) return;
+    shake_timer.machine = this;
+    events.add(&shake_timer, game_time);
+}
+
+void Machine::shake() {
+    pos.x += shake_x;
+    pos.y += shake_y;
+}
+
+// --- Slot methods -------------------------------------------
+
+void reels_add(Slot* slot);
+bool reels_animate(Slot* slot);
+
+// One draw per cell decides the spin. The machine scores it and may stretch
+// the spin before the stop is scheduled.
+void Slot::spin(Money stake, Vector2 pos) {
+    if (!spinning) {
+        result = SlotBuffer::generate(reels, rows, weights, machine->rng);
+        machine->payout = machine->calculate_win(result);
+        extra_rows = 0;
+        machine->on_spin();
+
+        spinning = true;
+        spin_start = game_time;
+        machine->spin_stop_timer.machine = machine;
+        events.add(&machine->spin_stop_timer, spin_start + spin_duration(extra_rows));
+
+        if (reels_animate(this)) reels_add(this);
+        gain_money(-stake, pos, machine);
+    }
+}
+
+void Slot::extend_spin(int rows) {
+    extra_rows += rows;
+}
+
+Rectangle Slot::get_reel_rect(int reel) {
+    float avail_space_x = rect.width - reels * 40;
+    float gap_x = avail_space_x / (reels + 1);
+
+    return Rectangle {
+        .x = this->rect.x + gap_x * (reel + 1) + reel * 40,
+        .y = this->rect.y,
+        .width = 40,
+        .height = this->rect.height,
+    };
+}
+
+int find_voice(int priority) {
+    for (int i = 0; i < MAX_VOICES; i++)
+        if (voices[i].sound < 0 || !IsSoundPlaying(sounds[voices[i].sound].aliases[i]))
+            return i;
+
+    int victim = -1;
+    for (int i = 0; i < MAX_VOICES; i++) {
+        const Voice& voice = voices[i];
+        if (voice.priority > priority) continue;
+        if (victim < 0 || voice.priority < voices[victim].priority ||
+            (voice.priority == voices[victim].priority && voice.started < voices[victim].started))
+            victim = i;
+    }
+    return victim;
+}
+
+void play_sound(SoundId id) {
+    if (headless) return;
+
+    SoundDef& def = sounds[id];
+    if (def.played_this_frame >= def.max_per_frame) return;
+
+    int i = find_voice(def.priority);
+    if (i < 0) return;
+
+    Voice& voice = voices[i];
+    if (voice.sound >= 0) StopSound(sounds[voice.sound].aliases[i]);
+
+    Sound alias = def.aliases[i];
+    SetSoundVolume(alias, def.volume + fx_rng.unit() * def.volume_jitter);
+    SetSoundPitch(alias, def.pitch + fx_rng.unit() * def.pitch_jitter);
+    PlaySound(alias);
+
+    voice = { id, def.priority, voice_plays++ };
+    def.played_this_frame++;
+}
+
+// call once per frame
+void end_audio_frame() {
+    for (SoundDef& def : sounds)
+        def.played_this_frame = 0;
+}
+
+void play_music(Music music) {
+    if (!headless) PlayMusicStream(music);
+}
+
+void stop_music(Music music) {
+    if (!headless) StopMusicStream(music);
+}
+
+void play_tick_sound() {
+    play_sound(SND_TICK);
+}
+
+void play_win_sound() {
+    static int x = 0;
+    x++;
+    if (x >= 2) x = 0;
+    play_sound(x ? SND_WIN_2 : SND_WIN_1);
+}
+
+
+void reels_sync(Slot* slot);
+
+void Slot::layout(Rectangle rect) {
+    this->rect = rect;
+    float avail_space_y = rect.height - rows * 40;
+    float gap_y = avail_space_y / (rows + 1);
+    row_height = 40 + gap_y;
+    if (lane >= 0) reels_sync(this);
+}
+
+// Seconds from spin() until the reel stops, extra_rows makes the last reel go further
+double Slot::reel_duration(int reel, int extra_rows) {
+    int distance = spin_distance + spin_distance_per_reel * reel;
+    if (reel == reels - 1) distance += extra_rows;
+    return reel_offset_time * reel + distance * row_height / speed;
+}
+
+double Slot::spin_duration(int extra_rows) {
+    double longest = 0;
+    for (int reel = 0; reel < reels; reel++)
+        longest = std::max(longest, reel_duration(reel, extra_rows));
+    return longest;
+}
+
+float reels_render_offset(Slot* slot, int reel);
+
+// Where the reel is between this step and the next, so it scrolls smoothly
+// no matter how the frame rate lines up with SIM_DT. Stopped reels sit at 0.
+float Slot::render_offset(int reel) {
+    return lane >= 0 ? reels_render_offset(this, reel) : 0;
+}
+
+void Slot::draw() {
+    float avail_space_x = rect.width - reels * 40;
+    float avail_space_y = rect.height - rows * 40;
+    float gap_x = avail_space_x / (reels + 1);
+    float gap_y = avail_space_y / (rows + 1);
+
+    for (int reel = 0; reel < reels; reel++) {
+        for (int row = -1; row < rows; row++) {
+            int tile = row >= 0 ? buffer.buffer[reel][row] : upper_buffer[reel];
+
+            Vector2 pos = {
+                .x = this->rect.x + gap_x * (reel + 1) + reel * 40,
+                .y = this->rect.y + gap_y * (row + 1) + row * 40 + render_offset(reel),
+            };
+
+            draw_sprite_clipped(tiles[tile].sprite, pos.x, pos.y, rect);
+        }
+    }
+}
+
+// --- Reels --------------------------------------------------
+// The animated slots of one machine type, as parallel arrays with one lane
+// per slot, so a step is a handful of flat loops instead of a virtual call per
+// machine. The result is already decided and so is when each reel stops, so
+// where a reel is follows from the time: filler scrolls by until the last rows
+// of its run, which are the result coming into place. Slots join in spin()
+// and leave when their stop timer ends the spin.
+
+struct ReelGroup {
+    int reels = 0;
+    std::vector<Slot*>  slots;
+    std::vector<double> start;
+    std::vector<float>  speed;
+    std::vector<float>  reel_offset_time;
+    std::vector<float>  row_height;
+    std::vector<double> last_tick;
+    std::vector<double> tick_rate;
+    std::vector<u8>     events;            // per lane for the reel being stepped: 1 stop, 2 crossed a row
+    std::vector<double> stop_at[MAX_SLOT_REELS];   // game_time the reel stops
+    std::vector<int>    required[MAX_SLOT_REELS];  // rows it crosses until then
+    std::vector<int>    crossing[MAX_SLOT_REELS];  // rows it should have crossed by now
+    std::vector<float>  offsets[MAX_SLOT_REELS];   // in [0, row_height), advance() when crossing
+    std::vector<int>    spin_iter[MAX_SLOT_REELS]; // rows crossed
+    std::vector<u8>     stopped[MAX_SLOT_REELS];
+};
+
+ReelGroup reel_groups[MAX_MACHINE_TYPES];
+u32       reel_groups_active = 0;  // bit per group with lanes in it
+bool      animate_all_reels  = false; // benchmarks animate headless and unplaced machines too
+
+ReelGroup& reel_group(Slot* slot) {
+    return reel_groups[u8(slot->machine->type)];
+}
+
+// Nobody sees the reels with no window or out of view
+bool reels_animate(Slot* slot) {
+    if (animate_all_reels) return true;
+    return !headless && slot->machine->spot >= 0 && spot_visible(slot->machine->spot);
+}
+
+// The tile that comes in at the top of reel after it crossed `crossed` rows.
+// The last rows of the run are the result, bottom row first.
+int reel_tile(Slot* slot, int reel, int crossed, int required) {
+    int row = required - 1 - crossed;
+    if (row >= 0 && row < slot->rows) return slot->result.at(reel, row);
+    return slot->weights.generate(fx_rng);
+}
+
+void reels_add(Slot* slot) {
+    ReelGroup& g = reel_group(slot);
+    g.reels = std::max(g.reels, slot->reels);
+    slot->lane = g.slots.size();
+    reel_groups_active |= 1u << u8(slot->machine->type);
+
+    g.slots.push_back(slot);
+    g.start.push_back(slot->spin_start);
+    g.speed.push_back(slot->speed);
+    g.reel_offset_time.push_back(slot->reel_offset_time);
+    g.row_height.push_back(slot->row_height);
+    g.last_tick.push_back(slot->last_tick);
+    g.tick_rate.push_back(slot->tick_rate);
+    g.events.push_back(0);
+    for (int reel = 0; reel < MAX_SLOT_REELS; reel++) {
+        bool missing = reel >= slot->reels; // never moves
+        int required = slot->spin_distance + slot->spin_distance_per_reel * reel;
+        if (reel == slot->reels - 1) required += slot->extra_rows;
+        g.stop_at[reel].push_back(missing ? 0 : slot->spin_start + slot->reel_duration(reel, slot->extra_rows));
+        g.required[reel].push_back(missing ? 0 : required);
+        g.crossing[reel].push_back(0);
+        g.offsets[reel].push_back(0);
+        g.spin_iter[reel].push_back(0);
+        g.stopped[reel].push_back(missing);
+        if (!missing) slot->upper_buffer[reel] = reel_tile(slot, reel, 0, required);
+    }
+}
+
+template<typename T>
+void swap_remove(std::vector<T>& v, int i) {
+    v[i] = v.back();
+    v.pop_back();
+}
+
+void reels_remove(Slot* slot) {
+    ReelGroup& g = reel_group(slot);
+    int i = slot->lane;
+    slot->last_tick = g.last_tick[i];
+    slot->lane = -1;
+
+    swap_remove(g.slots, i);
+    swap_remove(g.start, i);
+    swap_remove(g.speed, i);
+    swap_remove(g.reel_offset_time, i);
+    swap_remove(g.row_height, i);
+    swap_remove(g.last_tick, i);
+    swap_remove(g.tick_rate, i);
+    swap_remove(g.events, i);
+    for (int reel = 0; reel < MAX_SLOT_REELS; reel++) {
+        swap_remove(g.stop_at[reel], i);
+        swap_remove(g.required[reel], i);
+        swap_remove(g.crossing[reel], i);
+        swap_remove(g.offsets[reel], i);
+        swap_remove(g.spin_iter[reel], i);
+        swap_remove(g.stopped[reel], i);
+    }
+    if (i < (int)g.slots.size()) g.slots[i]->lane = i;
+    if (g.slots.empty()) reel_groups_active &= ~(1u << u8(slot->machine->type));
+}
+
+// When the reels stop was settled in spin(), so a speed upgrade mid-spin
+// only shows from the next one. The tick speeds up right away.
+void reels_sync(Slot* slot) {
+    ReelGroup& g = reel_group(slot);
+    g.tick_rate[slot->lane] = slot->tick_rate;
+}
+
+float reels_render_offset(Slot* slot, int reel) {
+    ReelGroup& g = reel_group(slot);
+    int i = slot->lane;
+    float offset = g.offsets[reel][i];
+    bool moving = !g.stopped[reel][i] && game_time - g.start[i] >= g.reel_offset_time[i] * reel;
+    if (!moving) return offset;
+    return std::min(offset + float(g.speed[i] * SIM_DT * sim_alpha), g.row_height[i]);
+}
+
+void update_reels_group(ReelGroup& g) {
+    int n = g.slots.size();
+
+    for (int i = 0; i < n; i++) {
+        if (game_time - g.last_tick[i] > g.tick_rate[i]) {
+            if (spot_visible(g.slots[i]->machine->spot)) play_tick_sound();
+            g.last_tick[i] = game_time;
+        }
+    }
+
+    for (int reel = 0; reel < g.reels; reel++) {
+        double* stop_at  = g.stop_at[reel].data();
+        int*    required = g.required[reel].data();
+        int*    crossing = g.crossing[reel].data();
+        int*    iter     = g.spin_iter[reel].data();
+        float*  offsets  = g.offsets[reel].data();
+        u8*     stopped  = g.stopped[reel].data();
+        u8*     events   = g.events.data();
+        bool    any      = false;
+
+        // No branches in here, so it vectorizes across lanes
+        for (int i = 0; i < n; i++) {
+            double t     = game_time - g.start[i] - g.reel_offset_time[i] * reel;
+            float travel = required[i] * g.row_height[i];
+            float pos    = std::min(float(std::max(t, 0.0) * g.speed[i]), travel);
+            int rows     = int(pos / g.row_height[i]);
+            bool done    = game_time >= stop_at[i];
+            crossing[i]  = done ? required[i] : rows;
+            offsets[i]   = done ? 0 : pos - rows * g.row_height[i];
+            u8 event     = u8(done & !stopped[i]) | u8(crossing[i] > iter[i]) << 1;
+            events[i]    = event;
+            any         |= event != 0;
+        }
+        if (!any) continue;
+
+        // Row crossings and stops touch the buffer and callbacks, so they
+        // happen per lane
+        for (int i = 0; i < n; i++) {
+            if (!events[i]) continue;
+            Slot* slot = g.slots[i];
+
+            while (iter[i] < crossing[i]) {
+                slot->buffer.advance(reel, slot->upper_buffer[reel]);
+                iter[i]++;
+                slot->upper_buffer[reel] = reel_tile(slot, reel, iter[i], required[i]);
+            }
+
+            if (events[i] & 1) {
+                stopped[i] = true;
+                slot->machine->on_reel_stop(reel);
+                play_sound(SND_REEL_STOP);
+            }
+        }
+    }
+}
+
+void update_reels() {
+    for (u32 active = reel_groups_active; active; active &= active - 1)
+        update_reels_group(reel_groups[std::countr_zero(active)]);
+}
+
+// --- SlotMachine methods ------------------------------------
+
+SlotMachine::SlotMachine() {
+    rng = world_rng.split();
+    slot.machine = this;
+}
+
+void reels_remove(Slot* slot);
+
+SlotMachine::~SlotMachine() {
+    events.remove(&auto_spin_timer);
+    events.remove(&spin_stop_timer);
+    if (slot.lane >= 0) reels_remove(&slot);
+}
+
+void SlotMachine::on_stop() {
+    gain_money(payout, { slot.rect.x, slot.rect.y }, this);
+}
+
+void SlotMachine::finish_spin() {
+    if (slot.lane >= 0) reels_remove(&slot);
+    slot.buffer = slot.result;
+    slot.spinning = false;
+    on_stop();
+    schedule_auto_spin();
+}
+
+bool Timer_SpinStop::action() {
+    events.remove(this);
+    machine->finish_spin();
+    return true;
+}
+
+// A spinning machine gets rescheduled when its reels stop
+bool Timer_AutoSpin::action() {
+    events.remove(this);
+    if (!machine->slot.spinning) {
+        machine->last_auto_click_time = game_time;
+        machine->click();
+    }
+    return true;
+}
+
+void SlotMachine::schedule_auto_spin() {
+    if (auto_click_time < 0 || slot.spinning) return;
+    auto_spin_timer.machine = this;
+    events.move(&auto_spin_timer, std::max(last_auto_click_time + auto_click_time, game_time));
+}
+
+double SlotMachine::expected_spin_time() {
+    return slot.spin_duration();
+}
+
+// Average seconds between two auto spins, negative if the machine doesn't auto spin.
+// The timer starts on the click, so a slow machine spins back to back.
+double SlotMachine::auto_spin_cycle() {
+    if (auto_click_time < 0) return -1;
+    return std::max(double(auto_click_time), expected_spin_time());
+}
+
+void SlotMachine::click() {
+    Rectangle button = spin_button_rect();
+    slot.spin(stake, {button.x, button.y});
+    start_shake();
+}
+
+void SlotMachine::layout() {
+    slot.layout({ pos.x + 10, pos.y + 60, 164, 86 });
+}
+
+void SlotMachine::upgrade(UpgradeType type) {
+    Machine::upgrade(type);
+
+    switch (type) {
+        case UpgradeType::Speed: {
+            slot.speed *= 1.3;
+            slot.reel_offset_time /= 1.3;
+            slot.tick_rate /= 1.1;
+            if (slot.tick_rate < 0.05)
+                slot.tick_rate = 0.05;
+            if (slot.lane >= 0) reels_sync(&slot);
+            break;
+        }
+        case UpgradeType::Double_Stake: {
+            stake *= 2;
+            calculate_ev();
+            break;
+        }
+        case UpgradeType::Auto_Click: {
+            if (auto_click_time < 0) auto_click_time = 5;
+            else auto_click_time /= 2;
+            schedule_auto_spin();
+            break;
+        }
+    }
+}
+
+void SlotMachine::draw_background() {
+    draw_sprite(sprite, pos.x, pos.y - 9);
+}
+
+Rectangle SlotMachine::spin_button_rect() {
+    return {
+        .x = pos.x + float(MACHINE_WIDTH - BUTTON_WIDTH) / 2,
+        .y = pos.y + float(MACHINE_HEIGHT - BUTTON_HEIGHT) - 8,
+        .width = float(BUTTON_WIDTH),
+        .height = float(BUTTON_HEIGHT),
+    };
+}
+
+void SlotMachine::draw_spin_button() {
+    Color color = { 0, 0, 255, 255 };
+    Rectangle button = spin_button_rect();
+
+    if (slot.spinning) {
+        button.y += 12;
+        button.height -= 12;
+        color = { 0, 0, 160, 80 };
+    }
+    else if (CheckCollisionPointRec(mouse, button) && !select_machine) {
+        color = Color { 32, 80, 255, 255 };
+        if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) issue_command(CommandType::Spin, spot_of(this));
+    }
+
+    DrawRectangleRec(button, color);
+    draw_text("SPIN", button.x + 6, button.y + 10, 20, WHITE);
+}
+
+void SlotMachine::animate() {
+    if (slot.spinning) shake();
+    layout();
+}
+
+void SlotMachine::draw() {
+    draw_slot();
+    draw_spin_button();
+}
+
+void SlotMachine::draw_chrome() {
+    draw_background();
+}
+
+void SlotMachine::draw_slot() {
+    slot.draw();
+}
+
+// Machines with a closed form override this, everyone else gets sampled
+SimResult simulate(SlotMachine* machine, double precision, u64 max_spins);
+
+void SlotMachine::calculate_ev() {
+    SimResult result = simulate(this, 0.005, 10000000);
+    this->ev = result.odds.ev;
+    this->variance = result.odds.variance;
+    this->win_percent = result.odds.win_chance;
+}
+
+// --- Simulation ---------------------------------------------
+// Monte Carlo for machines without a closed form. Every thread fills
+// SIM_BATCH buffers at a time from its own BatchRng, scores them with one
+// calculate_win_batch() call and folds its sums into the shared totals.
+// Stops once the EV is known to within precision (relative, 95% confidence),
+// or within SIM_ABS_PRECISION of the stake for machines that pay about nothing.
+
+#define SIM_BATCH         256
+#define SIM_MIN_SPINS     20000
+#define SIM_ABS_PRECISION 0.001
+
+struct SimSums {
+    u64    spins  = 0;
+    u64    wins   = 0;
+    double sum    = 0;
+    double sum_sq = 0;
+
+    void add(const SimSums& other) {
+        spins += other.spins;
+        wins += other.wins;
+        sum += other.sum;
+        sum_sq += other.sum_sq;
+    }
+};
+
+struct SimTotals {
+    std::mutex        mutex;
+    std::atomic<bool> done = false;
+    SimSums           sums;
+};
+
+SimResult sim_result(const SimSums& sums) {
+    SimResult result;
+    double n = double(sums.spins);
+    if (n < 2) return result;
+
+    double mean = sums.sum / n;
+    double variance = (sums.sum_sq - sums.sum * mean) / (n - 1);
+    double p = sums.wins / n;
+
+    result.spins = sums.spins;
+    result.odds.ev = mean;
+    result.odds.variance = variance;
+    result.odds.win_chance = p;
+    result.ev_error = 1.96 * sqrt(std::max(variance, 0.0) / n);
+    result.win_chance_error = 1.96 * sqrt(p * (1 - p) / n);
+    return result;
+}
+
+// Fills and scores batches for one thread. score(buffers, count, wins) is
+// calculate_win_batch() or anything shaped like it.
+template <typename Score>
+struct SimBatch {
+    Weights<int>*           weights;
+    int                     reels;
+    int                     rows;
+    int                     randoms;
+    Score                   score;
+    std::vector<SlotBuffer> buffers;
+    std::vector<u32>        random;
+    BatchRng                rng;
+
+    SimBatch(Weights<int>& weights, int reels, int rows, Score score, Rng stream)
+        : weights(&weights), reels(reels), rows(rows), randoms(SIM_BATCH * reels * rows + BATCH_RNG_LANES),
+          score(score), buffers(SIM_BATCH), random(randoms) {
+        rng.seed(stream);
+    }
+
+    SimSums run() {
+        Money wins[SIM_BATCH];
+        rng.fill(random.data(), randoms - BATCH_RNG_LANES);
+        SlotBuffer::generate_batch(buffers.data(), SIM_BATCH, reels, rows, *weights, random.data());
+        score(buffers.data(), SIM_BATCH, wins);
+
+        SimSums sums;
+        sums.spins = SIM_BATCH;
+        for (int i = 0; i < SIM_BATCH; i++) {
+            double win = double(wins[i]);
+            sums.wins += wins[i] != 0;
+            sums.sum += win;
+            sums.sum_sq += win * win;
+        }
+        return sums;
+    }
+};
+
+void sim_thread(SlotMachine* machine, SimTotals* totals, Rng stream, double precision, u64 max_spins) {
+    auto score = [machine](const SlotBuffer* buffers, int count, Money* wins) {
+        machine->calculate_win_batch(buffers, count, wins);
+    };
+    SimBatch batch(machine->slot.weights, machine->slot.reels, machine->slot.rows, score, stream);
+
+    while (!totals->done) {
+        SimSums sums = batch.run();
+
+        std::lock_guard<std::mutex> lock(totals->mutex);
+        totals->sums.add(sums);
+
+        if (totals->sums.spins >= max_spins) {
+            totals->done = true;
+        }
+        else if (totals->sums.spins >= SIM_MIN_SPINS) {
+            SimResult result = sim_result(totals->sums);
+            if (result.ev_error <= std::max(precision * fabs(result.odds.ev), SIM_ABS_PRECISION * machine->stake))
+                totals->done = true;
+        }
+    }
+}
+
+SimResult simulate(SlotMachine* machine, double precision, u64 max_spins) {
+    SimTotals totals;
+    int thread_count = std::max(1u, std::thread::hardware_concurrency());
+    Rng streams = machine->rng.split();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; i++)
+        threads.emplace_back(sim_thread, machine, &totals, streams.split(), precision, max_spins);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    return sim_result(totals.sums);
+}
+
+// Reproducible sampling for odds the game runs on: a fixed number of spins in
+// SIM_CHUNKS chunks, each with its own stream off seed, added up in chunk
+// order. Threads only decide who runs which chunk, so the result is the same
+// on any machine and any thread count.
+#define SIM_CHUNKS 64
+
+template <typename Score>
+SimResult simulate_fixed(Weights<int>& weights, int reels, int rows, Score score, Rng seed, u64 spins) {
+    Rng streams[SIM_CHUNKS];
+    for (Rng& stream : streams)
+        stream = seed.split();
+
+    u64 batches = std::max<u64>(1, spins / (SIM_CHUNKS * SIM_BATCH));
+    SimSums chunks[SIM_CHUNKS];
+    std::atomic<int> next_chunk = 0;
+
+    auto worker = [&]() {
+        for (int chunk; (chunk = next_chunk.fetch_add(1)) < SIM_CHUNKS; ) {
+            SimBatch batch(weights, reels, rows, score, streams[chunk]);
+            for (u64 i = 0; i < batches; i++)
+                chunks[chunk].add(batch.run());
+        }
+    };
+
+    int thread_count = std::clamp(int(std::thread::hardware_concurrency()), 1, SIM_CHUNKS);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; i++)
+        threads.emplace_back(worker);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    SimSums total;
+    for (const SimSums& chunk : chunks)
+        total.add(chunk);
+    return sim_result(total);
+}
+
+// Paylines and scatter have no closed form, load_machine_defs samples them
+// once at def.stake. Every machine of the type after that only scales it.
+#define SIM_DEF_SPINS (1 << 23)
+#define SIM_DEF_SEED  0x39584F444453ull
+
+Odds simulate_def(const MachineDef& def) {
+    Weights<int> weights;
+    for (int tile = 0; tile < def.tile_count; tile++)
+        if (def.tiles[tile].weight > 0) weights.add(tile, def.tiles[tile].weight);
+    weights.build();
+
+    std::vector<float> payouts(def.tile_count);
+    for (int tile = 0; tile < def.tile_count; tile++)
+        payouts[tile] = def.tiles[tile].payout;
+    Money pay[MAX_SLOT_TILES] = {};
+    for (int tile = 0; tile < def.tile_count; tile++)
+        pay[tile] = payout(payouts, tile, def.stake);
+
+    int cells = def.reels * def.rows;
+    CountPaytable counts;
+    if (def.rule == WinRule::Scatter) counts.build_scatter(payouts, cells, def.n, def.stake);
+
+    auto score = [&](const SlotBuffer* buffers, int count, Money* wins) {
+        for (int i = 0; i < count; i++)
+            wins[i] = evaluate(def, buffers[i], pay, counts.table.data());
+    };
+    return simulate_fixed(weights, def.reels, def.rows, score, Rng(SIM_DEF_SEED), SIM_DEF_SPINS).odds;
+}
+
+// --- Machines -----------------------------------------------
+
+// A slot machine the way its MachineDef says. Machines loaded with
+// --machines are this, the built-in ones are a FixedMachine.
+struct DefMachine : SlotMachine {
+    const MachineDef* def = nullptr;
+    Money pay[MAX_SLOT_TILES] = {}; // each tile's payout at the current stake
+    CountPaytable counts;           // NOfAKind and Scatter
+    bool anticipation = false;      // every reel but the last matches, so the last goes longer
+    bool anticipating = false;      // and the player can see it, from the second to last reel stopping
+
+    DefMachine(MachineType type) {
+        def = machine_def(type);
+        this->type  = type;
+        this->stake = def->stake;
+
+        slot.reels   = def->reels;
+        slot.rows    = def->rows;
+        slot.speed   = def->speed;
+        slot.spin_distance = def->spin_distance;
+        slot.spin_distance_per_reel = def->spin_distance_per_reel;
+        slot.reel_offset_time = def->reel_offset_time;
+        slot.tick_rate = def->tick_rate;
+        if (def->sprite) sprite = *def->sprite;
+
+        for (int tile = 0; tile < def->tile_count; tile++) {
+            const TileDef& t = def->tiles[tile];
+            if (t.weight > 0) slot.weights.add(tile, t.weight);
+            slot.tiles.push_back({ .id = tile, .sprite = t.sprite ? *t.sprite : Sprite{} });
+        }
+        slot.weights.build();
+
+        calculate_ev();
+        if (!headless) printf("Spawned %s (RTP: %.2f%%, Win Chance: %.2f%%)\n", def->id, ev*100, win_percent*100);
+
+        slot.buffer = SlotBuffer::generate(slot.reels, slot.rows, slot.weights, rng);
+    }
+
+    virtual void calculate_ev() override {
+        std::vector<float> payouts(def->tile_count);
+        for (int tile = 0; tile < def->tile_count; tile++)
+            payouts[tile] = def->tiles[tile].payout;
+        for (int tile = 0; tile < def->tile_count; tile++)
+            pay[tile] = ::payout(payouts, tile, stake);
+
+        int cells = slot.reels * slot.rows;
+        if (def->rule == WinRule::NOfAKind) counts.build_n_of_a_kind(payouts, cells, def->n, stake);
+        if (def->rule == WinRule::Scatter)  counts.build_scatter(payouts, cells, def->n, stake);
+
+        Odds odds;
+        switch (def->rule) {
+            case WinRule::Single:   odds = odds_single(slot.weights, payouts, stake); break;
+            case WinRule::MatchAll: odds = odds_match_all(slot.weights, payouts, slot.reels, stake); break;
+            case WinRule::NOfAKind: odds = odds_n_of_a_kind(slot.weights, payouts, cells, def->n, stake); break;
+            default:                odds = scaled_odds(); break;
+        }
+        ev = odds.ev;
+        variance = odds.variance;
+        win_percent = odds.win_chance;
+    }
+
+    // def->odds was sampled at def->stake when the def loaded
+    Odds scaled_odds() {
+        double scale = double(stake) / def->stake;
+        Odds odds = def->odds;
+        odds.ev *= scale;
+        odds.variance *= scale * scale;
+        return odds;
+    }
+
+    virtual Money calculate_win(const SlotBuffer& buffer) override {
+        return evaluate(*def, buffer, pay, counts.table.data());
+    }
+
+    virtual void calculate_win_batch(const SlotBuffer* buffers, int count, Money* wins) override {
+        for (int i = 0; i < count; i++)
+            wins[i] = evaluate(*def, buffers[i], pay, counts.table.data());
+    }
+
+    // every reel but the last matching this often stretches the spin
+    virtual double expected_spin_time() override {
+        if (!def->anticipation_rows) return slot.spin_duration();
+        double anticipation_chance = 0;
+        for (double p : tile_chances(slot.weights, def->tile_count)) {
+            double match = 1;
+            for (int reel = 1; reel < slot.reels; reel++)
+                match *= p;
+            anticipation_chance += match;
+        }
+        return slot.spin_duration() + anticipation_chance * (slot.spin_duration(def->anticipation_rows) - slot.spin_duration());
+    }
+
+    virtual double auto_spin_cycle() override {
+        if (!def->restart_auto_spin) return SlotMachine::auto_spin_cycle();
+        if (auto_click_time < 0) return -1;
+        return expected_spin_time() + auto_click_time;
+    }
+
+    virtual void on_spin() override {
+        anticipation = def->anticipation_rows > 0;
+        for (int reel = 1; reel < slot.reels - 1; reel++)
+            anticipation &= slot.result.at(reel, 0) == slot.result.at(0, 0);
+        if (anticipation) slot.extend_spin(def->anticipation_rows);
+    }
+
+    virtual void on_reel_stop(int reel) override {
+        if (reel == slot.reels - 2 && anticipation) {
+            anticipating = true;
+            if (msc_anticipation_count == 0) play_music(msc_anticipation);
+            msc_anticipation_count++;
+        }
+    }
+
+    virtual void on_stop() override {
         SlotMachine::on_stop();
-        last_auto_click_time = game_time;
-        if (anticipation) {
-            anticipation = false;
+        if (def->restart_auto_spin) last_auto_click_time = game_time;
+        anticipation = false;
+        if (anticipating) {
+            anticipating = false;
             msc_anticipation_count--;
-            if (msc_anticipation_count == 0) StopMusicStream(msc_anticipation);
+            if (msc_anticipation_count == 0) stop_music(msc_anticipation);
+        }
+    }
+
+    virtual void draw_slot() override {
+        if (anticipating) {
+            double t = game_time * 10;
+            Color color = decimal_part(t) < 0.5 ? Color{54, 16, 112,255} : Color{117, 21, 143,255};
+            DrawRectangleRec(slot.get_reel_rect(slot.reels - 1), color);
+        }
+        SlotMachine::draw_slot();
+    }
+
+    virtual void layout() override {
+        Rectangle r = def->slot_rect;
+        slot.layout({ pos.x + r.x, pos.y + r.y, r.width, r.height });
+    }
+};
+
+// A built-in machine, scored by evaluate() instantiated for its constexpr
+// definition: no rule switch, fixed loop bounds, and one virtual call per
+// batch in the simulator.
+template <const MachineDef& D>
+struct FixedMachine : DefMachine {
+    FixedMachine(MachineType type) : DefMachine(type) {
+        assert(def == &D);
+    }
+
+    virtual Money calculate_win(const SlotBuffer& buffer) override {
+        return evaluate(D, buffer, pay, counts.table.data());
+    }
+
+    virtual void calculate_win_batch(const SlotBuffer* buffers, int count, Money* wins) override {
+        const Money* table = counts.table.data();
+        for (int i = 0; i < count; i++)
+            wins[i] = evaluate(D, buffers[i], pay, table);
+    }
+};
+
+Machine* make_machine(MachineType type) {
+    switch (type) {
+        case MachineType::None: return nullptr;
+        case MachineType::M1X1: return new FixedMachine<m1x1_def>(type);
+        case MachineType::M3X1: return new FixedMachine<m3x1_def>(type);
+        case MachineType::MB5:  return new FixedMachine<mb5_def>(type);
+        default:                return machine_def(type) ? new DefMachine(type) : nullptr;
+    }
+}
+
+// --- Timers -------------------------------------------------
+
+struct Timer_Police : Timer {
+    Timer_Police() {
+        text = "POLICE";
+    }
+
+    virtual bool action() override {
+        for (int i = int(placed_machines.size()) - 1; i >= 0; i--) {
+            Machine* machine = placed_machines[i];
+            if (machine->upgrades > max_upgrades)
+                remove_machine(machine);
+        }
+        police_timer = nullptr;
+        has_illegal_machines = false;
+        floor_dirty = true;
+        stop_music(msc_police);
+        return false;
+    }
+};
+
+struct TaxDef {
+    const char* name;
+    double      period;
+    Money       cost;
+};
+
+TaxDef taxes[] = {
+    { "Car Payment", 199, 500  },
+    { "Rent",        299, 1000 },
+};
+
+struct Timer_Tax : Timer {
+    int tax; // index into taxes
+    double t;
+
+    Timer_Tax(int tax) {
+        this->tax = tax;
+        this->text = taxes[tax].name;
+        this->t = taxes[tax].period;
+        this->cost = taxes[tax].cost;
+    }
+
+    virtual bool action() override {
+        gain_money(-this->cost, {400.0f,400.0f});
+        this->deadline += t;
+        return true;
+    }
+};
+
+// --- Gameplay functions -------------------------------------
+
+void format_money_text(int i) {
+    Money amount = texts.amount[i];
+    snprintf(texts.text[i], TEXT_LENGTH, "%c$%ld", amount < 0 ? '-' : '+', amount < 0 ? -amount : amount);
+}
+
+void show_money_text(Money amount, Vector2 pos, const void* source) {
+    if (headless) return;
+
+    if (source) {
+        for (int i = 0; i < texts.count; i++) {
+            if (texts.source[i] == source && texts.t[i] < TEXT_COALESCE && (texts.amount[i] < 0) == (amount < 0)) {
+                texts.amount[i] += amount;
+                format_money_text(i);
+                return;
+            }
+        }
+    }
+
+    if (texts.count == MAX_TEXTS) return;
+
+    int i = texts.count++;
+    texts.x[i]          = texts.prev_x[i] = pos.x;
+    texts.y[i]          = texts.prev_y[i] = pos.y - 10;
+    texts.velocity_x[i] = fx_rng.range(-100, 100);
+    texts.velocity_y[i] = -100;
+    texts.t[i]          = 0;
+    texts.amount[i]     = amount;
+    texts.source[i]     = source;
+    format_money_text(i);
+}
+
+// A machine's pos is on the floor, popups float over the view. Machines
+// out of view don't get one, thousands of them would fill the pool.
+void gain_money(Money amount, Vector2 pos, const Machine* source) {
+    if (amount == 0) return;
+    if (amount > 0) play_win_sound();
+
+    money += amount;
+    if (!source)
+        show_money_text(amount, pos, nullptr);
+    else if (spot_visible(source->spot))
+        show_money_text(amount, floor_to_view(pos), source);
+}
+
+bool button(ButtonState state) {
+    bool hover = state.enabled && CheckCollisionPointRec(mouse, state.rect);
+    if (hover) state.background.r = color_clamp(state.background.r * 1.5);
+    if (hover) state.background.g = color_clamp(state.background.g * 1.5);
+    if (hover) state.background.b = color_clamp(state.background.b * 1.5);
+
+    if (!state.enabled) {
+        state.background = GRAY;
+        state.background.a = 128;
+        state.text_color.a = 128;
+    }
+
+    DrawRectangleRec(state.rect, state.background);
+
+    int w = measure_text(state.text, state.font_size);
+    draw_text(state.text, state.rect.x + state.rect.width / 2 - w/2.0f, 2 + state.rect.y + state.rect.height/2 - state.font_size/2.0f, state.font_size, state.text_color);
+
+    bool click = hover && state.enabled && IsMouseButtonPressed(MOUSE_BUTTON_LEFT);
+    return click;
+}
+
+void go_to_screen(GameScreen _screen) {
+    if (select_machine) return;
+
+    if (screen == _screen) return;
+
+    screen = _screen;
+
+    switch (screen) {
+        case GameScreen::Shop: {
+            break;
+        }
+        default: break;
+    }
+}
+
+void pop_free_spot() {
+    free_spot_queued[free_spots.front()] = false;
+    std::pop_heap(free_spots.begin(), free_spots.end(), std::greater<int>());
+    free_spots.pop_back();
+}
+
+int first_empty_spot() {
+    // spots taken from the middle of the heap are only dropped once they come up
+    while (!free_spots.empty() && machines[free_spots.front()]) pop_free_spot();
+    return free_spots.empty() ? -1 : free_spots.front();
+}
+
+void push_free_spot(int i) {
+    if (free_spot_queued[i]) return; // taken and freed again before it came up, still in there
+    free_spot_queued[i] = true;
+    free_spots.push_back(i);
+    std::push_heap(free_spots.begin(), free_spots.end(), std::greater<int>());
+}
+
+// call before the machine goes in, anything but the front stays until first_empty_spot
+void take_free_spot(int i) {
+    if (!free_spots.empty() && free_spots.front() == i) pop_free_spot();
+}
+
+void grow_floor(int shells) {
+    floor_shells = std::min(shells, FLOOR_MAX_SHELLS);
+    spot_count = shell_spots(floor_shells);
+    machines.resize(spot_count, nullptr);
+    spot_unlocked.resize(spot_count, 0);
+    free_spot_queued.resize(spot_count, 0);
+    floor_dirty = true;
+}
+
+void place_machine(int i, Machine* machine) {
+    assert(spot_unlocked[i] && !machines[i]);
+    take_free_spot(i);
+    floor_dirty = true;
+    machines[i] = machine;
+    machine->spot = i;
+    machine->placed_index = placed_machines.size();
+    placed_machines.push_back(machine);
+    if (machine->upgrades > max_upgrades) illegal_machines++;
+    machine->pos = spot_position(i);
+    machine->layout();
+}
+
+void remove_machine(Machine* machine) {
+    int i = machine->spot;
+    machines[i] = nullptr;
+    push_free_spot(i);
+    floor_dirty = true;
+    if (machine->upgrades > max_upgrades) illegal_machines--;
+
+    Machine* last = placed_machines.back();
+    placed_machines[machine->placed_index] = last;
+    last->placed_index = machine->placed_index;
+    placed_machines.pop_back();
+    delete machine;
+}
+
+void unlock_spot(int i) {
+    spot_unlocked[i] = true;
+    unlocked_spots++;
+    push_free_spot(i);
+    floor_dirty = true;
+    if (unlocked_spots == spot_count && floor_shells < FLOOR_MAX_SHELLS)
+        grow_floor(floor_shells + 1);
+}
+
+void buy_spot(int i) {
+    assert(!spot_unlocked[i]);
+    if (!spot_unlocked[i]) {
+        play_sound(SND_UPGRADE);
+        gain_money(-spot_price(i), mouse);
+        unlock_spot(i);
+    }
+}
+
+ShopEntry* roll_shop_entry() {
+
+    switch (shop_types_weights.generate(world_rng)) {
+        case ShopEntryType::Machine: {
+            return shop_machines_weights.generate(world_rng);
+        }
+        case ShopEntryType::Upgrade: {
+            return shop_upgrades_weights.generate(world_rng);
+        }
+    }
+}
+
+void roll_shop() {
+    shop_entries.clear();
+    for (int i = 0; i < 3; i++) {
+        shop_entries.push_back(roll_shop_entry());
+    }
+}
+
+void reroll_shop() {
+    roll_cost *= ROLL_COST_INCREASE_FACTOR;
+    gain_money(-roll_cost, mouse);
+    roll_shop();
+}
+
+void buy_shop_entry(int i) {
+    shop_entries[i]->buy();
+    shop_entries[i] = nullptr;
+}
+
+void check_illegal_machines() {
+    bool ok = illegal_machines == 0;
+    if (!ok == has_illegal_machines)
+        return;
+
+    has_illegal_machines = !ok;
+
+    if (has_illegal_machines) {
+        police_timer = new Timer_Police();
+        timers.add(police_timer, game_time + POLICE_TIME);
+        play_music(msc_police);
+    }
+}
+
+void apply_upgrade(Machine* machine, UpgradeType type) {
+    play_sound(SND_UPGRADE);
+
+    select_machine = false;
+    bool was_illegal = machine->upgrades > max_upgrades;
+    machine->upgrade(type);
+    illegal_machines += machine->upgrades > max_upgrades && !was_illegal;
+    floor_dirty = true;
+
+    check_illegal_machines();
+}
+
+// --- Floor cache --------------------------------------------
+// Machine art and the empty/locked spot panels barely ever change, so the
+// spots in view get drawn once into a render texture at screen resolution.
+// Each frame just copies every spot's region out of it, shaken machines
+// included. Anything that changes what a spot looks like sets floor_dirty,
+// and so does moving the view.
+
+#define SPOT_MARGIN 10 // machine art pokes out of the spot a bit
+
+RenderTexture2D floor_cache = {};
+float           floor_cache_scale = 0;
+FloorView       floor_cache_view = {};
+std::vector<u8> spot_affordable; // the price turns green, so it's part of the cache
+
+Rectangle spot_region(int i) {
+    Vector2 pos = spot_position(i);
+    return { pos.x - SPOT_MARGIN, pos.y - SPOT_MARGIN, MACHINE_WIDTH + 2 * SPOT_MARGIN, MACHINE_HEIGHT + 2 * SPOT_MARGIN };
+}
+
+void draw_spot_chrome(int i) {
+    Vector2 pos = spot_position(i);
+    int x = pos.x;
+    int y = pos.y;
+
+    if (machines[i]) {
+        machines[i]->draw_chrome();
+        return;
+    }
+
+    DrawRectangle(x, y, MACHINE_WIDTH, MACHINE_HEIGHT, Color{0, 0, 0, 90});
+    bool detail = floor_view.zoom >= FLOOR_DETAIL_ZOOM;
+
+    if (spot_unlocked[i]) {
+        if (!detail) return;
+        float _y = y + 5;
+        draw_text("NO MACHINE", x + 10, _y, 20, WHITE);
+        _y += 40;
+        draw_text("Open the SHOP", x + 10, _y, 20, WHITE);
+        _y += 20;
+        draw_text("to buy one", x + 10, _y, 20, WHITE);
+    }
+    else if (!detail) {
+        DrawRectangleLinesEx({ float(x), float(y), MACHINE_WIDTH, MACHINE_HEIGHT }, 8, spot_affordable[i] ? GREEN : RED);
+    }
+    else {
+        float _y = y + 5;
+        draw_text("SPOT", x + 10, _y, 40, RED);
+        _y += 40;
+        draw_text("LOCKED", x + 10, _y, 40, RED);
+
+        char buf[64];
+        snprintf(buf, sizeof(buf), "Price: $%ld", spot_price(i));
+        draw_text(buf, x + 10, y + 90, 20, spot_affordable[i] ? GREEN : RED);
+    }
+}
+
+// calls f(spot) for every spot in view
+template <typename F>
+void for_visible_spots(F f) {
+    for (int y = floor_view.y0; y <= floor_view.y1; y++)
+        for (int x = floor_view.x0; x <= floor_view.x1; x++) {
+            int i = spot_at(x, y);
+            if (i >= 0) f(i);
+        }
+}
+
+// Call outside of BeginMode2D, drawing into a texture resets the camera
+void update_floor_cache() {
+    spot_affordable.resize(spot_count, 0);
+    for_visible_spots([](int i) {
+        bool affordable = spot_price(i) <= money;
+        if (!spot_unlocked[i] && affordable != spot_affordable[i]) {
+            spot_affordable[i] = affordable;
+            floor_dirty = true;
+        }
+    });
+
+    if (floor_cache_scale != screen_scale) {
+        if (floor_cache.id) UnloadRenderTexture(floor_cache);
+        floor_cache = LoadRenderTexture(FLOOR_VIEW_WIDTH * screen_scale, VIEWPORT_HEIGHT * screen_scale);
+        floor_cache_scale = screen_scale;
+        floor_dirty = true;
+    }
+
+    if (floor_cache_view.target.x != floor_view.target.x || floor_cache_view.target.y != floor_view.target.y ||
+        floor_cache_view.zoom != floor_view.zoom) {
+        floor_cache_view = floor_view;
+        floor_dirty = true;
+    }
+
+    if (!floor_dirty) return;
+    floor_dirty = false;
+
+    BeginTextureMode(floor_cache);
+    ClearBackground(BLANK);
+    BeginMode2D(Camera2D { .target = floor_view.target, .zoom = floor_cache_scale * floor_view.zoom });
+
+    // Color blends as usual but alpha adds up instead of being blended
+    // away, so the texture ends up premultiplied.
+    rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE, RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD, RL_FUNC_ADD);
+    BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+
+    for_visible_spots(draw_spot_chrome);
+
+    EndBlendMode();
+    EndMode2D();
+    EndTextureMode();
+}
+
+// Copies spot i's region of the cache to the spot, offset by how far its
+// machine shook. Draw in the floor camera.
+void draw_floor_cache(int i, Vector2 offset) {
+    Rectangle region = spot_region(i);
+    float scale = floor_cache_scale * floor_cache_view.zoom;
+    Vector2 target = floor_cache_view.target;
+    Rectangle src = {
+        (region.x - target.x) * scale,
+        floor_cache.texture.height - (region.y + region.height - target.y) * scale, // render textures are upside down
+        region.width * scale,
+        -region.height * scale,
+    };
+    Rectangle dst = { region.x + offset.x, region.y + offset.y, region.width, region.height };
+    DrawTexturePro(floor_cache.texture, src, dst, {}, 0, WHITE);
+}
+
+// The whole view in one quad, for when nothing in it can be seen shaking
+void draw_floor_cache_all() {
+    float w = FLOOR_VIEW_WIDTH / floor_cache_view.zoom;
+    float h = VIEWPORT_HEIGHT / floor_cache_view.zoom;
+    Rectangle src = { 0, 0, float(floor_cache.texture.width), -float(floor_cache.texture.height) };
+    Rectangle dst = { floor_cache_view.target.x, floor_cache_view.target.y, w, h };
+    DrawTexturePro(floor_cache.texture, src, dst, {}, 0, WHITE);
+}
+
+// --- Shop entries -------------------------------------------
+
+struct ShopEntry_Machine : ShopEntry {
+    std::string text;
+    Money _cost;
+    MachineType type;
+    Sprite sprite = {};
+
+    ShopEntry_Machine(MachineType type) {
+        const MachineDef* def = machine_def(type);
+        this->text = std::format("{} - Machine", def->name);
+        this->tagline = def->tagline;
+        this->name = this->text.c_str();
+        this->_cost = def->price;
+        this->type = type;
+        if (def->sprite) this->sprite = *def->sprite;
+    }
+
+    virtual Money cost() override {
+        return this->_cost;
+    }
+
+    virtual void draw_icon(int x, int y) override {
+        draw_sprite_scaled(sprite, x, y, 0.73);
+    }
+
+    virtual const char* lock_reason() override {
+        if (first_empty_spot() >= 0)
+            return nullptr;
+        return "No empty spots";
+    }
+
+    virtual void buy() override {
+        gain_money(-_cost, mouse);
+        place_machine(first_empty_spot(), make_machine(type));
+    }
+};
+
+struct ShopEntry_Upgrade : ShopEntry {
+    UpgradeType type;
+    Money _cost;
+
+    ShopEntry_Upgrade(UpgradeType type) {
+        this->type = type;
+        this->_cost = 200;
+
+        switch (this->type) {
+            case UpgradeType::Speed: {
+                this->name = "SPEED UPGRADE";
+                this->tagline = "Increase a Machine's Speed";
+
+                break;
+            }
+            case UpgradeType::Auto_Click: {
+                this->name = "AUTO SPIN UPGRADE";
+                this->tagline = "Increase a Machine's Auto Spin Rate";
+                break;
+            }
+            case UpgradeType::Double_Stake: {
+                this->name = "STAKE DOUBLE UPGRADE";
+                this->tagline = "Double a Machine's Stake (and thus wins!)";
+                break;
+            }
         }
+
+        this->tagline = tagline;
     }
 
-    virtual void draw_slot() override {
-        if (anticipation) {
-            double t = game_time * 10;
-            Color color = decimal_part(t) < 0.5 ? Color{54, 16, 112,255} : Color{117, 21, 143,255};
-            DrawRectangleRec(slot.get_reel_rect(2), color);
+    virtual Money cost() override {
+        return this->_cost;
+    }
+
+    virtual void buy() override {
+        gain_money(-_cost, mouse);
+        select_machine = true;
+        select_machine_text = this->name;
+        select_machine_callback = [](Machine* machine) {
+            apply_upgrade(machine, current_upgarde_type);
+        };
+        current_upgarde_type = this->type;
+        _cost *= UPGRADE_COST_INCREASE_FACTOR;
+    }
+
+    virtual const char* lock_reason() override {
+        if (!placed_machines.empty())
+            return nullptr;
+        return "Buy some machines first";
+    }
+
+    virtual void draw_icon(int x, int y) override {
+        DrawRectangle(x, y, 130, 180, GOLD);
+    };
+};
+
+// --- Update -----------------------------------------------------
+// Everything that moves on its own. The window and --headless both call this.
+
+
+void update_texts() {
+    int n = texts.count;
+    float step = dt;
+
+    memcpy(texts.prev_x, texts.x, n * sizeof(float));
+    memcpy(texts.prev_y, texts.y, n * sizeof(float));
+    for (int i = 0; i < n; i++) texts.x[i] += texts.velocity_x[i] * step;
+    for (int i = 0; i < n; i++) texts.y[i] += texts.velocity_y[i] * step;
+    for (int i = 0; i < n; i++) texts.velocity_y[i] += TEXT_GRAVITY * step;
+    for (int i = 0; i < n; i++) texts.t[i] += step;
+
+    for (int i = 0; i < texts.count; i++) {
+        if (texts.t[i] <= TEXT_DURATION) continue;
+
+        int last = --texts.count;
+        texts.x[i]          = texts.x[last];
+        texts.y[i]          = texts.y[last];
+        texts.prev_x[i]     = texts.prev_x[last];
+        texts.prev_y[i]     = texts.prev_y[last];
+        texts.velocity_x[i] = texts.velocity_x[last];
+        texts.velocity_y[i] = texts.velocity_y[last];
+        texts.t[i]          = texts.t[last];
+        texts.amount[i]     = texts.amount[last];
+        texts.source[i]     = texts.source[last];
+        memcpy(texts.text[i], texts.text[last], TEXT_LENGTH);
+        i--;
+    }
+}
+
+void run_commands();
+
+void update_game(double step) {
+    run_commands();
+
+    dt = step;
+    game_time += step;
+    sim_tick++;
+
+    {
+        PROFILE_SCOPE(PROF_SIM_MACHINES);
+        update_reels();
+        events.run(game_time);
+    }
+    {
+        PROFILE_SCOPE(PROF_SIM_TIMERS);
+        timers.run(game_time);
+    }
+    {
+        PROFILE_SCOPE(PROF_SIM_TEXTS);
+        update_texts();
+    }
+}
+
+// --- Fast forward -------------------------------------------
+// Skips ahead without spinning anything. Between two timer deadlines every
+// auto spinning machine earns (EV - stake) per expected spin, drawn as one
+// normal sample with the machine's variance, and then the timer fires.
+// An hour is a few dozen segments no matter how fast the machines are.
+
+struct FastForwardReport {
+    double seconds = 0;
+    double spins   = 0;
+    Money  net     = 0; // what the machines made after stakes
+    Money  start   = 0;
+    Money  end     = 0;
+};
+
+FastForwardReport fast_forward(double seconds) {
+    FastForwardReport report;
+    report.seconds = seconds;
+    report.start = money;
+    double end = game_time + seconds;
+
+    while (game_time < end) {
+        double segment_end = std::min(end, std::max(timers.next_deadline(), game_time));
+        double step = segment_end - game_time;
+
+        for (Machine* machine : placed_machines) {
+            SlotMachine* slot_machine = dynamic_cast<SlotMachine*>(machine);
+            if (!slot_machine) continue;
+
+            double cycle = slot_machine->auto_spin_cycle();
+            if (cycle <= 0) continue;
+
+            double spins = step / cycle;
+            double mean = spins * (slot_machine->ev - slot_machine->stake);
+            double sd = sqrt(std::max(spins * slot_machine->variance, 0.0));
+            Money net = llround(mean + sd * slot_machine->rng.gauss());
+
+            money += net;
+            report.net += net;
+            report.spins += spins;
         }
-        SlotMachine::draw_slot();
+
+        game_time = segment_end;
+        dt = step;
+        timers.run(game_time);
+    }
+
+    for (Machine* machine : placed_machines) {
+        if (SlotMachine* slot_machine = dynamic_cast<SlotMachine*>(machine)) {
+            slot_machine->last_auto_click_time = game_time;
+            slot_machine->schedule_auto_spin();
+        }
+    }
+
+    report.end = money;
+    show_money_text(report.net, { 300, 300 }, nullptr);
+    return report;
+}
+
+// --- Commands -----------------------------------------------
+// Input doesn't touch the game directly, it queues a command that runs at
+// the start of the next step. --record writes the seed and every command with
+// its step to a file, --replay feeds them back at the same steps, so the run
+// comes out bit for bit the same, with a window or --headless at full speed.
+// Commands check again whether they're allowed, things change within a step.
+
+#define REPLAY_MAGIC   0x50525839 // "9XRP"
+#define REPLAY_VERSION 1
+
+struct ReplayHeader {
+    u32    magic;
+    u32    version;
+    u64    seed;
+    double sim_dt;        // a replay only holds up with the same step
+    u64    ticks;         // how long the recorded run went
+    u32    command_count;
+    u32    reserved;
+};
+
+struct Replay {
+    bool                 recording = false;
+    bool                 replaying = false;
+    const char*          path      = nullptr;
+    u64                  seed      = 0;
+    u64                  ticks     = 0;
+    std::vector<Command> commands;      // read from --replay
+    int                  next      = 0; // next command to replay
+    std::vector<Command> recorded;      // written to --record, replayed ones included
+};
+
+std::vector<Command> pending_commands;
+Replay replay;
+
+int spot_of(Machine* machine) {
+    return machine->spot;
+}
+
+void issue_command(CommandType type, int arg) {
+    if (replay.replaying) return; // the replay is in charge
+    pending_commands.push_back({ .tick = sim_tick, .type = type, .reserved = {}, .arg = arg });
+}
+
+void apply_command(const Command& command) {
+    int i = command.arg;
+    bool spot = i >= 0 && i < spot_count;
+
+    switch (command.type) {
+        case CommandType::Spin: {
+            if (spot && machines[i]) machines[i]->click();
+            break;
+        }
+        case CommandType::BuySpot: {
+            if (spot && !spot_unlocked[i] && spot_price(i) <= money) buy_spot(i);
+            break;
+        }
+        case CommandType::BuyShopEntry: {
+            if (i < 0 || i >= int(shop_entries.size()) || select_machine) break;
+            ShopEntry* entry = shop_entries[i];
+            if (entry && money >= entry->cost() && !entry->lock_reason()) buy_shop_entry(i);
+            break;
+        }
+        case CommandType::SelectMachine: {
+            if (select_machine && spot && machines[i]) select_machine_callback(machines[i]);
+            break;
+        }
+        case CommandType::Reroll: {
+            if (money >= roll_cost) reroll_shop();
+            break;
+        }
+        case CommandType::FastForward: {
+            auto start = std::chrono::steady_clock::now();
+            FastForwardReport report = fast_forward(i);
+            if (!headless)
+                printf("Fast forwarded %.0fs in %.1fus: %.0f spins made $%ld, money $%ld -> $%ld\n",
+                       report.seconds, seconds_since(start) * 1e6, report.spins, report.net, report.start, report.end);
+            break;
+        }
+    }
+}
+
+void run_commands() {
+    if (replay.replaying) {
+        while (replay.next < int(replay.commands.size()) && replay.commands[replay.next].tick <= sim_tick) {
+            const Command& command = replay.commands[replay.next++];
+            apply_command(command);
+            if (replay.recording) replay.recorded.push_back(command); // so the new recording replays from the start
+        }
+        if (sim_tick >= replay.ticks) replay.replaying = false; // hand over to the player
+        return;
+    }
+
+    for (Command& command : pending_commands) {
+        command.tick = sim_tick;
+        apply_command(command);
+        if (replay.recording) replay.recorded.push_back(command);
+    }
+    pending_commands.clear();
+}
+
+bool write_replay(const char* path) {
+    ReplayHeader header = {
+        .magic         = REPLAY_MAGIC,
+        .version       = REPLAY_VERSION,
+        .seed          = replay.seed,
+        .sim_dt        = SIM_DT,
+        .ticks         = sim_tick,
+        .command_count = u32(replay.recorded.size()),
+        .reserved      = 0,
+    };
+
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(replay.recorded.data(), sizeof(Command), replay.recorded.size(), file);
+    return fclose(file) == 0;
+}
+
+bool read_replay(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+
+    ReplayHeader header = {};
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == REPLAY_MAGIC &&
+              header.version == REPLAY_VERSION &&
+              header.sim_dt == SIM_DT;
+    if (ok) {
+        replay.commands.resize(header.command_count);
+        ok = fread(replay.commands.data(), sizeof(Command), header.command_count, file) == header.command_count;
     }
+    fclose(file);
+    if (!ok) return false;
+
+    replay.seed = header.seed;
+    replay.ticks = header.ticks;
+    replay.next = 0;
+    replay.replaying = true;
+    return true;
+}
+
+// --- Init gameplay ------------------------------------------
+
+std::vector<ShopEntry*> shop_catalog; // owns everything the shop weights point at
+
+// Starts a fresh run, tearing down whatever the previous one left behind
+void init_game() {
+    for (Machine* machine : placed_machines)
+        delete machine;
+    placed_machines.clear();
+    machines.assign(9, nullptr);
+    spot_unlocked.assign(9, 0);
+    free_spots.clear();
+    free_spot_queued.assign(9, 0);
+    floor_shells     = 1;
+    spot_count       = 9;
+    unlocked_spots   = 0;
+    illegal_machines = 0;
+
+    timers.clear();
+    assert(events.heap.empty()); // machines take their events with them
+    police_timer = nullptr;
+    has_illegal_machines = false;
+
+    for (ShopEntry* entry : shop_catalog)
+        delete entry;
+    shop_catalog.clear();
+
+    screen                 = GameScreen::Machines;
+    money                  = START_MONEY;
+    roll_cost              = START_ROLL_COST;
+    max_upgrades           = START_MAX_UPGRADES;
+    select_machine         = false;
+    msc_anticipation_count = 0;
+    game_time              = 0;
+    sim_tick               = 0;
+    run_start_time         = 0;
+    floor_dirty            = true;
+    texts.count            = 0;
+
+    // --- Init shop ----------------------------------------------
+
+    // Built-in machines and upgrades keep their catalog index with or
+    // without --machines, so saves agree. Loaded machines go last.
+    shop_machines_weights = {};
+    auto add_machines = [](int from, int to) {
+        for (int type = from; type < to; type++) {
+            ShopEntry* entry = new ShopEntry_Machine(MachineType(type));
+            shop_catalog.push_back(entry);
+            shop_machines_weights.add(entry, machine_defs[type]->shop_weight);
+        }
+    };
+
+    ShopEntry* shop_entry_upgrade_speed = new ShopEntry_Upgrade(UpgradeType::Speed);
+    ShopEntry* shop_entry_upgrade_auto_click = new ShopEntry_Upgrade(UpgradeType::Auto_Click);
+    ShopEntry* shop_entry_upgrade_double_stake = new ShopEntry_Upgrade(UpgradeType::Double_Stake);
+
+    add_machines(1, BUILTIN_MACHINE_TYPES);
+    shop_catalog.push_back(shop_entry_upgrade_speed);
+    shop_catalog.push_back(shop_entry_upgrade_auto_click);
+    shop_catalog.push_back(shop_entry_upgrade_double_stake);
+    add_machines(BUILTIN_MACHINE_TYPES, machine_type_count);
+
+    shop_upgrades_weights = {};
+    shop_upgrades_weights.add(shop_entry_upgrade_auto_click, 1);
+    shop_upgrades_weights.add(shop_entry_upgrade_double_stake, 1);
+    shop_upgrades_weights.add(shop_entry_upgrade_speed, 1);
+
+    shop_types_weights = {};
+    shop_types_weights.add(ShopEntryType::Machine, 10);
+    shop_types_weights.add(ShopEntryType::Upgrade, 3);
+
+    shop_machines_weights.build();
+    shop_upgrades_weights.build();
+    shop_types_weights.build();
+
+    roll_shop();
+
+    // --- Init taxes ---------------------------------------------
+    for (int i = 0; i < int(ARRAY_SIZE(taxes)); i++)
+        timers.add(new Timer_Tax(i), game_time + taxes[i].period);
+
+    display_money = money;
+}
+
+// --- Save ---------------------------------------------------
+// A run is a fixed size header of plain data followed by one byte per spot
+// and the machines on the floor, written and read in one go. Autosave copies
+// the state into whichever of two buffers the writer thread isn't busy with,
+// so a save costs the frame a copy and never a disk write. The buffers keep
+// their capacity, so that copy doesn't allocate either.
+// A spin in flight already paid its stake and knows its result, so it's
+// saved with both and settles the moment the save loads.
+
+#define SAVE_MAGIC        0x56535839 // "9XSV"
+#define SAVE_VERSION      3
+#define SAVE_FILE         "9xgambler.sav"
+#define SAVE_MAX_CATALOG  16
+#define SAVE_MAX_TAXES    8
+#define SAVE_SHOP_SIZE    3
+#define AUTOSAVE_INTERVAL 10.0           // seconds
+#define MAX_OFFLINE_TIME  (24 * 60 * 60) // the most a load catches up on
+
+struct SavedMachine {
+    MachineType type;
+    u8          reels;
+    u8          rows;
+    u8          spinning;
+    i32         spot;
+    i32         upgrades;
+    i32         reserved3;
+    Money       stake;
+    Money       payout;   // of the spin in flight
+    float       auto_click_time;
+    float       speed;
+    float       reel_offset_time;
+    float       reserved2;
+    double      tick_rate;
+    double      last_auto_click_time;
+    u64         rng[4];
+    i8          tiles[MAX_SLOT_REELS][MAX_SLOT_ROWS];
+    i8          result[MAX_SLOT_REELS][MAX_SLOT_ROWS]; // of the spin in flight
+};
+
+struct SaveHeader {
+    u32          magic;
+    u32          version;
+    u32          size;     // of the header
+    u32          spot_count;
+    u32          machine_count;
+    u32          reserved;
+    i64          saved_at; // unix time
+    double       game_time;
+    double       run_start_time;
+    Money        money;
+    Money        roll_cost;
+    i32          max_upgrades;
+    i32          police;   // the police are on their way
+    double       police_deadline;
+    u64          world_rng[4];
+    i8           shop[SAVE_SHOP_SIZE];            // index into shop_catalog, -1 once bought
+    u8           reserved2[5];
+    Money        catalog_cost[SAVE_MAX_CATALOG];  // upgrade prices go up as they're bought
+    double       tax_deadlines[SAVE_MAX_TAXES];
+};
+
+struct SaveState {
+    SaveHeader                header;
+    std::vector<u8>           spot_unlocked; // header.spot_count of them
+    std::vector<SavedMachine> machines;      // header.machine_count of them
 };
 
-struct MB5 : SlotMachine {
-    std::vector<float> payouts = {};
+static_assert(ARRAY_SIZE(taxes) <= SAVE_MAX_TAXES);
+static_assert(MACHINE_TYPE_LIMIT - 1 + 3 <= SAVE_MAX_CATALOG);
+static_assert(std::is_trivially_copyable_v<SaveHeader>);
+static_assert(std::is_trivially_copyable_v<SavedMachine>);
+
+void capture_save(SaveState& state) {
+    SaveHeader& save = state.header;
+    save = {};
+    save.magic          = SAVE_MAGIC;
+    save.version        = SAVE_VERSION;
+    save.size           = sizeof(SaveHeader);
+    save.spot_count     = spot_count;
+    save.machine_count  = placed_machines.size();
+    save.saved_at       = time(nullptr);
+    save.game_time      = game_time;
+    save.run_start_time = run_start_time;
+    save.money          = money;
+    save.roll_cost      = roll_cost;
+    save.max_upgrades   = max_upgrades;
+    memcpy(save.world_rng, world_rng.s, sizeof(save.world_rng));
+
+    if (police_timer) {
+        save.police = 1;
+        save.police_deadline = police_timer->deadline;
+    }
+
+    for (Timer* timer : timers.heap)
+        if (Timer_Tax* tax = dynamic_cast<Timer_Tax*>(timer))
+            save.tax_deadlines[tax->tax] = tax->deadline;
+
+    assert(shop_catalog.size() <= SAVE_MAX_CATALOG);
+    for (int i = 0; i < int(shop_catalog.size()); i++)
+        save.catalog_cost[i] = shop_catalog[i]->cost();
+
+    assert(shop_entries.size() <= SAVE_SHOP_SIZE);
+    for (int i = 0; i < SAVE_SHOP_SIZE; i++) {
+        save.shop[i] = -1;
+        if (i >= int(shop_entries.size())) continue;
+        for (int j = 0; j < int(shop_catalog.size()); j++)
+            if (shop_entries[i] == shop_catalog[j])
+                save.shop[i] = j;
+    }
+
+    state.spot_unlocked.assign(spot_unlocked.begin(), spot_unlocked.end());
+
+    // by spot, so the same run always saves the same bytes
+    state.machines.clear();
+    for (int i = 0; i < spot_count; i++) {
+        SlotMachine* machine = dynamic_cast<SlotMachine*>(machines[i]);
+        if (!machine) continue;
+
+        SavedMachine& saved = state.machines.emplace_back();
+        saved = {};
+        saved.type                 = machine->type;
+        saved.spot                 = i;
+        saved.reels                = machine->slot.buffer.reels;
+        saved.rows                 = machine->slot.buffer.rows;
+        saved.upgrades             = machine->upgrades;
+        saved.stake                = machine->stake;
+        saved.auto_click_time      = machine->auto_click_time;
+        saved.speed                = machine->slot.speed;
+        saved.reel_offset_time     = machine->slot.reel_offset_time;
+        saved.tick_rate            = machine->slot.tick_rate;
+        saved.last_auto_click_time = machine->last_auto_click_time;
+        memcpy(saved.rng, machine->rng.s, sizeof(saved.rng));
+        for (int reel = 0; reel < saved.reels; reel++)
+            for (int row = 0; row < saved.rows; row++)
+                saved.tiles[reel][row] = machine->slot.buffer.at(reel, row);
+
+        if (machine->slot.spinning) {
+            saved.spinning = 1;
+            saved.payout   = machine->payout;
+            for (int reel = 0; reel < saved.reels; reel++)
+                for (int row = 0; row < saved.rows; row++)
+                    saved.result[reel][row] = machine->slot.result.at(reel, row);
+        }
+    }
+}
+
+// Starts a fresh run and puts the saved one in its place
+bool apply_save(const SaveState& state) {
+    const SaveHeader& save = state.header;
+    if (save.magic != SAVE_MAGIC || save.version != SAVE_VERSION || save.size != sizeof(SaveHeader) ||
+        state.spot_unlocked.size() != save.spot_count || state.machines.size() != save.machine_count)
+        return false;
+
+    int shells = 1;
+    while (u32(shell_spots(shells)) < save.spot_count && shells < FLOOR_MAX_SHELLS) shells++;
+    if (u32(shell_spots(shells)) != save.spot_count) return false;
+
+    init_game();
 
-    MB5() {
-        this->stake = 10;
+    game_time      = save.game_time;
+    run_start_time = save.run_start_time;
+    money          = save.money;
+    display_money  = money;
+    roll_cost      = save.roll_cost;
+    max_upgrades   = save.max_upgrades;
 
-        slot.reels   = 4;
-        slot.rows    = 3;
-        slot.speed   = 800;
-        slot.spin_distance = 25;
-        slot.spin_distance_per_reel = 4;
-        slot.reel_offset_time = 0.1;
-        texture = tex_mb5;
-        payouts = { 0, 20, 100, 800, 1200 };
-        slot.weights = {{0,8}, {1,5}, {2,3}, {3,2}, {4,2}};
-        slot.tick_rate = 0.15;
+    grow_floor(shells);
+    for (int i = 0; i < spot_count; i++) {
+        if (!state.spot_unlocked[i]) continue;
+        spot_unlocked[i] = true;
+        unlocked_spots++;
+        push_free_spot(i);
+    }
 
-        slot.tiles = {
-            { .id = 0, .texture = tex_tile_dot  },
-            { .id = 1, .texture = tex_tile_orange  },
-            { .id = 2, .texture = tex_tile_cherry  },
-            { .id = 3, .texture = tex_tile_7 },
-            { .id = 4, .texture = tex_tile_777  },
+    for (const SavedMachine& saved : state.machines) {
+        if (saved.spot < 0 || saved.spot >= spot_count || !spot_unlocked[saved.spot] || machines[saved.spot]) continue;
+        if (saved.type == MachineType::None || !machine_def(saved.type)) continue;
+        DefMachine* machine = (DefMachine*)make_machine(saved.type);
+        if (!machine) continue;
+
+        machine->upgrades             = saved.upgrades;
+        machine->stake                = saved.stake;
+        machine->auto_click_time      = saved.auto_click_time;
+        machine->slot.speed           = saved.speed;
+        machine->slot.reel_offset_time = saved.reel_offset_time;
+        machine->slot.tick_rate       = saved.tick_rate;
+        machine->last_auto_click_time = saved.last_auto_click_time;
+        memcpy(machine->rng.s, saved.rng, sizeof(saved.rng));
+        // the tiles index paytables and sprites, a bad one keeps the freshly rolled buffer
+        auto load_tiles = [&](const i8 (&tiles)[MAX_SLOT_REELS][MAX_SLOT_ROWS], SlotBuffer& buffer) {
+            bool valid = saved.reels == machine->slot.reels && saved.rows == machine->slot.rows;
+            for (int reel = 0; valid && reel < saved.reels; reel++)
+                for (int row = 0; row < saved.rows; row++)
+                    valid &= tiles[reel][row] >= 0 && tiles[reel][row] < machine->def->tile_count;
+            if (valid)
+                for (int reel = 0; reel < saved.reels; reel++)
+                    for (int row = 0; row < saved.rows; row++)
+                        buffer.at(reel, row) = tiles[reel][row];
+            return valid;
         };
+        load_tiles(saved.tiles, machine->slot.buffer);
 
-        calculate_ev();
-        printf("Spawned MB5 (RTP: %.2f%%, Win Chance: %.2f%%)\n", ev*100, win_percent*100);
+        machine->calculate_ev();
+        place_machine(saved.spot, machine);
+
+        // the spin in flight pays out as if its reels stopped now
+        if (saved.spinning) {
+            machine->slot.result = machine->slot.buffer;
+            load_tiles(saved.result, machine->slot.result);
+            machine->payout = saved.payout;
+            machine->finish_spin();
+        }
+        else {
+            machine->schedule_auto_spin();
+        }
+    }
+
+    // machines split their streams off world_rng, so this goes last
+    memcpy(world_rng.s, save.world_rng, sizeof(save.world_rng));
+
+    for (int i = 0; i < int(shop_catalog.size()); i++)
+        if (ShopEntry_Upgrade* upgrade = dynamic_cast<ShopEntry_Upgrade*>(shop_catalog[i]))
+            upgrade->_cost = save.catalog_cost[i];
+
+    for (int i = 0; i < SAVE_SHOP_SIZE && i < int(shop_entries.size()); i++) {
+        int entry = save.shop[i];
+        shop_entries[i] = entry >= 0 && entry < int(shop_catalog.size()) ? shop_catalog[entry] : nullptr;
+    }
+
+    Timer_Tax* tax_timers[SAVE_MAX_TAXES];
+    int tax_count = 0;
+    for (Timer* timer : timers.heap)
+        if (Timer_Tax* tax = dynamic_cast<Timer_Tax*>(timer))
+            tax_timers[tax_count++] = tax;
+    for (int i = 0; i < tax_count; i++)
+        timers.move(tax_timers[i], save.tax_deadlines[tax_timers[i]->tax]);
+
+    if (save.police) {
+        police_timer = new Timer_Police();
+        timers.add(police_timer, save.police_deadline);
+        has_illegal_machines = true;
+        play_music(msc_police);
+    }
+
+    return true;
+}
+
+bool write_save_file(const char* path, const SaveState& save) {
+    char temp[1024];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    FILE* file = fopen(temp, "wb");
+    if (!file) return false;
+    bool ok = fwrite(&save.header, sizeof(save.header), 1, file) == 1;
+    ok &= fwrite(save.spot_unlocked.data(), 1, save.spot_unlocked.size(), file) == save.spot_unlocked.size();
+    ok &= fwrite(save.machines.data(), sizeof(SavedMachine), save.machines.size(), file) == save.machines.size();
+    ok &= fclose(file) == 0;
+
+    // a crash halfway through leaves the previous save alone
+    return ok && rename(temp, path) == 0;
+}
+
+bool read_save_file(const char* path, SaveState& save) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+
+    SaveHeader& header = save.header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == SAVE_MAGIC && header.version == SAVE_VERSION && header.size == sizeof(header) &&
+              header.spot_count <= u32(shell_spots(FLOOR_MAX_SHELLS)) && header.machine_count <= header.spot_count;
+    if (ok) {
+        save.spot_unlocked.resize(header.spot_count);
+        save.machines.resize(header.machine_count);
+        ok = fread(save.spot_unlocked.data(), 1, save.spot_unlocked.size(), file) == save.spot_unlocked.size() &&
+             fread(save.machines.data(), sizeof(SavedMachine), save.machines.size(), file) == save.machines.size();
+    }
+    fclose(file);
+    return ok;
+}
+
+struct Autosave {
+    char                    path[1024] = {};
+    SaveState               buffers[2];
+    int                     pending = -1; // buffer waiting for the writer
+    int                     writing = -1; // buffer the writer is busy with
+    bool                    quit    = false;
+    double                  last    = 0;  // game_time of the last autosave
+    std::mutex              mutex;
+    std::condition_variable wake;
+    std::thread             writer;
+};
+
+Autosave autosave;
+
+void autosave_writer() {
+    std::unique_lock lock(autosave.mutex);
+    while (true) {
+        autosave.wake.wait(lock, []() { return autosave.pending >= 0 || autosave.quit; });
+        if (autosave.pending < 0) return;
+
+        int buffer = autosave.writing = autosave.pending;
+        autosave.pending = -1;
+        lock.unlock();
+
+        if (!write_save_file(autosave.path, autosave.buffers[buffer]))
+            fprintf(stderr, "Can't write %s\n", autosave.path);
+
+        lock.lock();
+        autosave.writing = -1;
+    }
+}
 
-        slot.buffer = SlotBuffer::generate(slot.reels, slot.rows, slot.weights);
+void autosave_start(const char* path) {
+    snprintf(autosave.path, sizeof(autosave.path), "%s", path);
+    autosave.last = game_time;
+    autosave.writer = std::thread(autosave_writer);
+}
+
+void autosave_now() {
+    std::lock_guard lock(autosave.mutex);
+    int buffer = autosave.writing == 0 ? 1 : 0;
+    capture_save(autosave.buffers[buffer]);
+    autosave.pending = buffer;
+    autosave.last = game_time;
+    autosave.wake.notify_one();
+}
+
+// saves one last time and waits for it to hit the disk
+void autosave_stop() {
+    autosave_now();
+    {
+        std::lock_guard lock(autosave.mutex);
+        autosave.quit = true;
+    }
+    autosave.wake.notify_one();
+    autosave.writer.join();
+}
+
+// --- Headless -----------------------------------------------
+// ./9XGAMBLER --headless [--time <seconds>] [--runs <n>] [--curve <file.csv>]
+// Plays the economy with a scripted player as fast as the CPU allows, with
+// no window and no audio. Prints time to bankruptcy for every run and can
+// write the bankroll curves as CSV.
+
+#define HEADLESS_THINK  0.25 // the scripted player acts this often
+#define HEADLESS_SAMPLE 10.0 // bankroll curve resolution
+
+struct HeadlessConfig {
+    double      time   = 4 * 60 * 60;
+    int         runs   = 1;
+    const char* curve  = nullptr;
+    const char* record = nullptr; // the commands of a single run
+};
+
+// what the player keeps around for bills due within the next minute
+Money reserve() {
+    Money reserve = 0;
+    for (Timer* timer : timers.heap)
+        if (timer->time_left() < 60)
+            reserve += timer->cost;
+    return reserve;
+}
+
+Machine* least_upgraded_machine() {
+    Machine* result = nullptr;
+    for (Machine* machine : placed_machines)
+        if ((!result || machine->upgrades < result->upgrades))
+            result = machine;
+    return result;
+}
+
+// Spins machines that don't spin on their own, fills empty spots, buys
+// upgrades as long as no machine goes illegal and never touches the rent money.
+// Plays through issue_command like the player does, so --record captures it.
+// The commands run at the start of the next step, available leaves out
+// the stakes already asked for.
+void strategy_step() {
+    if (select_machine) {
+        if (Machine* target = least_upgraded_machine())
+            issue_command(CommandType::SelectMachine, target->spot);
+        return;
+    }
+
+    Money available = money;
+    for (Machine* machine : placed_machines) {
+        SlotMachine* slot_machine = dynamic_cast<SlotMachine*>(machine);
+        if (slot_machine && slot_machine->auto_click_time < 0 && !slot_machine->slot.spinning && available >= slot_machine->stake) {
+            issue_command(CommandType::Spin, machine->spot);
+            available -= slot_machine->stake;
+        }
+    }
+
+    Money spare = available - reserve();
+
+    for (int i = 0; i < int(shop_entries.size()); i++) {
+        ShopEntry* entry = shop_entries[i];
+        if (!entry || entry->lock_reason() || entry->cost() > spare) continue;
+
+        if (dynamic_cast<ShopEntry_Upgrade*>(entry)) {
+            Machine* target = least_upgraded_machine();
+            if (target->upgrades >= max_upgrades) continue;
+        }
+
+        issue_command(CommandType::BuyShopEntry, i);
+        return;
+    }
+
+    if (first_empty_spot() < 0) {
+        for (int i = 0; i < spot_count; i++) {
+            if (spot_unlocked[i]) continue;
+            if (spot_price(i) <= spare) issue_command(CommandType::BuySpot, i);
+            return;
+        }
+    }
+
+    if (roll_cost * 4 <= spare)
+        issue_command(CommandType::Reroll);
+}
+
+int run_headless(HeadlessConfig config) {
+    if (config.record && config.runs != 1) {
+        fprintf(stderr, "Can't record more than one run\n");
+        return 1;
+    }
+
+    FILE* curve = nullptr;
+    if (config.curve) {
+        curve = fopen(config.curve, "w");
+        if (!curve) {
+            fprintf(stderr, "Can't open %s\n", config.curve);
+            return 1;
+        }
+        fprintf(curve, "run,time,money\n");
     }
 
-    virtual Money calculate_win() override {
-        Money win = 0;
-        for (SlotTile t : slot.tiles) {
-            int count = 0;
-            for (int reel = 0; reel < slot.reels; reel++)
-                for (int row = 0; row < slot.rows; row++)
-                    if (slot.buffer.at(reel, row) == t.id)
-                            count++;
-            if (count >= 5) {
-                win += this->payouts[t.id] * stake;
+    int bankruptcies = 0;
+    double bankrupt_time_sum = 0;
+    double simulated = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int run = 0; run < config.runs; run++) {
+        init_game();
+
+        double next_think = 0;
+        double next_sample = 0;
+        bool bankrupt = false;
+
+        while (game_time < config.time) {
+            if (game_time >= next_think) {
+                strategy_step();
+                next_think += HEADLESS_THINK;
+            }
+
+            update_game(SIM_DT);
+
+            if (curve && game_time >= next_sample) {
+                fprintf(curve, "%d,%.0f,%ld\n", run, game_time, money);
+                next_sample += HEADLESS_SAMPLE;
+            }
+
+            if (money < 0) {
+                bankrupt = true;
+                break;
             }
         }
-        return win;
+
+        int machine_count = placed_machines.size();
+
+        simulated += game_time;
+        if (bankrupt) {
+            bankruptcies++;
+            bankrupt_time_sum += game_time;
+            printf("run %d: bankrupt after %d:%.2d (%d machines)\n", run, int(game_time / 60), int(game_time) % 60, machine_count);
+        }
+        else {
+            printf("run %d: solvent after %d:%.2d with $%ld (%d machines)\n", run, int(game_time / 60), int(game_time) % 60, money, machine_count);
+        }
     }
 
-    virtual void on_stop() override {
-        SlotMachine::on_stop();
-        last_auto_click_time = game_time;
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%d/%d runs went bankrupt", bankruptcies, config.runs);
+    if (bankruptcies) printf(", on average after %.0fs", bankrupt_time_sum / bankruptcies);
+    printf("\nsimulated %.0fs in %.2fs (%.0fx real time)\n", simulated, wall, simulated / wall);
+
+    if (curve) fclose(curve);
+    if (config.record && !write_replay(config.record)) {
+        fprintf(stderr, "Can't write replay %s\n", config.record);
+        return 1;
     }
+    return 0;
+}
+
+// Runs a recording to its end as fast as possible and prints a hash of the
+// state, two builds that print different hashes for the same file diverge.
+int run_replay_headless() {
+    auto start = std::chrono::steady_clock::now();
+    while (sim_tick < replay.ticks) update_game(SIM_DT);
+
+    SaveState save;
+    capture_save(save);
+    save.header.saved_at = 0;
+
+    u64 hash = 0xCBF29CE484222325ull; // FNV-1a
+    auto add = [&](const void* data, size_t size) {
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ ((const u8*)data)[i]) * 0x100000001B3ull;
+    };
+    add(&save.header, sizeof(save.header));
+    add(save.spot_unlocked.data(), save.spot_unlocked.size());
+    add(save.machines.data(), save.machines.size() * sizeof(SavedMachine));
+
+    printf("Replayed %lu ticks (%.0fs, %d commands) in %.2fs: money $%ld, state %016lx\n",
+           sim_tick, game_time, replay.next, seconds_since(start), money, hash);
+    return 0;
+}
+
+// --- EV check -----------------------------------------------
+// ./9XGAMBLER --check-ev compares the closed form odds against the simulator
 
-    virtual void draw_slot() override {
-        slot.rect = { pos.x + 5, pos.y + 60, 184, 107 };
-        slot.draw();
+int check_ev() {
+    bool ok = true;
+
+    for (int type = 1; type < machine_type_count; type++) {
+        WinRule rule = machine_defs[type]->rule;
+        if (rule == WinRule::Paylines || rule == WinRule::Scatter) continue; // simulated anyway
+
+        SlotMachine* machine = (SlotMachine*)make_machine(MachineType(type));
+        SimResult sampled = simulate(machine, 0.005, 20000000);
+
+        // 4 sigma, the error is a 1.96 sigma half width
+        bool ev_ok = fabs(sampled.odds.ev - machine->ev) <= 2 * sampled.ev_error;
+        bool win_ok = fabs(sampled.odds.win_chance - machine->win_percent) <= 2 * sampled.win_chance_error;
+        bool variance_ok = fabs(sampled.odds.variance - machine->variance) <= 0.1 * machine->variance;
+        printf("  exact EV %.4f, sampled %.4f +- %.4f | exact win chance %.4f%%, sampled %.4f%% +- %.4f%% | exact SD %.2f, sampled %.2f (%lu spins) %s\n",
+               machine->ev, sampled.odds.ev, sampled.ev_error,
+               machine->win_percent*100, sampled.odds.win_chance*100, sampled.win_chance_error*100,
+               sqrt(machine->variance), sqrt(sampled.odds.variance),
+               sampled.spins, ev_ok && win_ok && variance_ok ? "OK" : "MISMATCH");
+
+        ok = ok && ev_ok && win_ok && variance_ok;
+        delete machine;
     }
-};
 
-// --- Timers -------------------------------------------------
+    return ok ? 0 : 1;
+}
 
-struct Timer_Police : Timer {
-    Timer_Police() {
-        text = "POLICE";
-    }
+// --- Benchmarks ---------------------------------------------
+// The 9XGAMBLER_BENCH target builds this file with BENCHMARK defined and
+// gets this main() instead of the game's.
 
-    virtual bool action() {
-        for (int i = 0; i < 9; i++) {
-            if (machines[i] && machines[i]->upgrades > max_upgrades) {
-                delete machines[i];
-                machines[i] = nullptr;
-            }
-        }
-        police_timer = nullptr;
-        has_illegal_machines = false;
-        StopMusicStream(msc_police);
-        return false;
-    }
-};
+#ifdef BENCHMARK
 
-struct Timer_Tax : Timer {
-    double t;
+// The old layout: weight copies of every entry, one index per draw
+template <typename T>
+struct ExpandedWeights {
+    std::vector<T> array;
 
-    Timer_Tax(const char* name, double t, Money cost) {
-        this->text = name;
-        this->t = t;
-        this->time_left = t;
-        this->cost = cost;
+    ExpandedWeights(std::initializer_list<std::pair<T, int>> list) {
+        for (auto& item : list)
+            for (int i = 0; i < item.second; i++)
+                array.push_back(item.first);
     }
 
-    virtual bool action() override {
-        gain_money(-this->cost, {400.0f,400.0f});
-        this->time_left = t;
-        return true;
+    T pick(u32 random) {
+        return array[(u64(random) * array.size()) >> 32];
     }
 };
 
-// --- Gameplay functions -------------------------------------
+volatile i64 bench_sink = 0; // results go here so the work can't be optimized away
+
+// draws per second over the same random numbers
+template <typename W>
+double bench_draws(W& weights, const std::vector<u32>& random, int rounds) {
+    int sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+        for (u32 r : random)
+            sum += weights.pick(r);
+    double t = seconds_since(start);
+    bench_sink = sum;
+    return double(random.size()) * rounds / t;
+}
 
-void gain_money(Money amount, Vector2 pos) {
-    if (amount == 0) return;
-    if (amount > 0) play_win_sound();
+// Every number ends up here, printed as it comes and written as JSON at the
+// end, so a script can compare two builds.
+struct BenchResult {
+    std::string name;
+    double      value;
+    const char* unit;
+};
 
-    pos.y -= 10;
-    money += amount;
+std::vector<BenchResult> bench_results;
+const char* bench_filter = nullptr;
 
-    bool neg = amount < 0;
-    if (neg) amount = -amount;
+bool bench_enabled(const char* group) {
+    return !bench_filter || strstr(group, bench_filter);
+}
 
-    TextOnScreen text {
-        .text     = std::format("{}${}", neg ? "-" : "+", amount),
-        .pos      = pos,
-        .color    = neg ? RED : GREEN,
-    };
-    text.velocity.x = GetRandomValue(-100, 100);
-    texts.push_back(text);
+void bench_report(const char* name, double value, const char* unit) {
+    printf("%-36s %14.3f %s\n", name, value, unit);
+    bench_results.push_back({ name, value, unit });
 }
 
-bool button(ButtonState state) {
-    bool hover = state.enabled && CheckCollisionPointRec(mouse, state.rect);
-    if (hover) state.background.r = color_clamp(state.background.r * 1.5);
-    if (hover) state.background.g = color_clamp(state.background.g * 1.5);
-    if (hover) state.background.b = color_clamp(state.background.b * 1.5);
+// calls f until BENCH_TIME has passed, f does `work` units per call
+#define BENCH_TIME 0.25
+
+template <typename F>
+double bench_rate(double work, F f) {
+    f(); // warm up
+    u64 calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    double t = 0;
+    do {
+        f();
+        calls++;
+    } while ((t = seconds_since(start)) < BENCH_TIME);
+    return work * calls / t;
+}
 
-    if (!state.enabled) {
-        state.background = GRAY;
-        state.background.a = 128;
-        state.text_color.a = 128;
-    }
+void bench_weights(const char* name, std::initializer_list<std::pair<int, int>> list) {
+    Weights<int> alias = list;
+    ExpandedWeights<int> expanded = list;
 
-    DrawRectangleRec(state.rect, state.background);
+    std::vector<u32> random(1 << 16);
+    Rng rng(1234);
+    rng.fill(random.data(), random.size());
 
-    int w = MeasureText(state.text, state.font_size);
-    DrawText(state.text, state.rect.x + state.rect.width / 2 - w/2.0f, 2 + state.rect.y + state.rect.height/2 - state.font_size/2.0f, state.font_size, state.text_color);
+    bench_report(TextFormat("weights.pick/%s", name), bench_draws(alias, random, 500), "draws/s");
+    bench_report(TextFormat("weights.pick_expanded/%s", name), bench_draws(expanded, random, 500), "draws/s");
 
-    bool click = hover && state.enabled && IsMouseButtonPressed(MOUSE_BUTTON_LEFT);
-    return click;
+    double rate = bench_rate(4096, [&]() {
+        int sum = 0;
+        for (int i = 0; i < 4096; i++)
+            sum += alias.generate(rng);
+        bench_sink = sum;
+    });
+    bench_report(TextFormat("weights.generate/%s", name), rate, "draws/s");
 }
 
-void go_to_screen(GameScreen _screen) {
-    if (select_machine) return;
-
-    if (screen == _screen) return;
-
-    screen = _screen;
+const char* machine_name(MachineType type) {
+    const MachineDef* def = machine_def(type);
+    return def ? def->id : "None";
+}
 
-    switch (screen) {
-        case GameScreen::Shop: {
-            break;
-        }
-        default: break;
+const MachineType bench_machine_types[] = { MachineType::M1X1, MachineType::M3X1, MachineType::MB5 };
+
+void bench_machine(MachineType type) {
+    const char* name = machine_name(type);
+    SlotMachine* machine = (SlotMachine*)make_machine(type);
+    Slot& slot = machine->slot;
+    Rng rng(1234);
+
+    if (bench_enabled("slot_buffer")) {
+        bench_report(TextFormat("slot_buffer.generate/%s", name), bench_rate(1024, [&]() {
+            for (int i = 0; i < 1024; i++)
+                bench_sink = SlotBuffer::generate(slot.reels, slot.rows, slot.weights, rng).at(0, 0);
+        }), "buffers/s");
+
+        std::vector<SlotBuffer> buffers(1024);
+        std::vector<u32> random(buffers.size() * slot.reels * slot.rows);
+        bench_report(TextFormat("slot_buffer.generate_batch/%s", name), bench_rate(buffers.size(), [&]() {
+            rng.fill(random.data(), random.size());
+            SlotBuffer::generate_batch(buffers.data(), buffers.size(), slot.reels, slot.rows, slot.weights, random.data());
+        }), "buffers/s");
     }
-}
 
-void buy_spot(int i) {
-    assert(!spot_unlocked[i]);
-    if (!spot_unlocked[i]) {
-        PlaySound(snd_upgrade);
-        gain_money(-spot_prices[i], mouse);
-        spot_unlocked[i] = true;
+    if (bench_enabled("calculate_win")) {
+        std::vector<SlotBuffer> buffers(4096);
+        for (SlotBuffer& buffer : buffers)
+            buffer = SlotBuffer::generate(slot.reels, slot.rows, slot.weights, rng);
+        std::vector<Money> wins(buffers.size());
+
+        bench_report(TextFormat("calculate_win/%s", name), bench_rate(buffers.size(), [&]() {
+            Money sum = 0;
+            for (SlotBuffer& buffer : buffers)
+                sum += machine->calculate_win(buffer);
+            bench_sink = sum;
+        }), "wins/s");
+        bench_report(TextFormat("calculate_win_batch/%s", name), bench_rate(buffers.size(), [&]() {
+            machine->calculate_win_batch(buffers.data(), buffers.size(), wins.data());
+        }), "wins/s");
     }
-}
 
-ShopEntry* roll_shop_entry() {
+    if (bench_enabled("calculate_ev")) {
+        auto start = std::chrono::steady_clock::now();
+        machine->calculate_ev();
+        bench_report(TextFormat("calculate_ev/%s", name), seconds_since(start) * 1000, "ms");
 
-    switch (shop_types_weights.generate()) {
-        case ShopEntryType::Machine: {
-            return shop_machines_weights.generate();
-        }
-        case ShopEntryType::Upgrade: {
-            return shop_upgrades_weights.generate();
+        // what a machine without a closed form pays on purchase
+        start = std::chrono::steady_clock::now();
+        machine->SlotMachine::calculate_ev();
+        bench_report(TextFormat("calculate_ev_sampled/%s", name), seconds_since(start) * 1000, "ms");
+        machine->calculate_ev();
+    }
+
+    if (bench_enabled("slot_update")) {
+        for (int speed_upgrades : { 0, 10 }) {
+            SlotMachine* fast = (SlotMachine*)make_machine(type);
+            for (int i = 0; i < speed_upgrades; i++)
+                fast->upgrade(UpgradeType::Speed);
+
+            // spin again the moment it stops, like a maxed out auto spin
+            u64 steps = 0, spun = 0;
+            animate_all_reels = true;
+            double spins = bench_rate(1, [&]() {
+                fast->click();
+                spun++;
+                while (fast->slot.spinning) {
+                    dt = SIM_DT;
+                    game_time += SIM_DT;
+                    update_reels();
+                    events.run(game_time);
+                    steps++;
+                }
+            });
+            animate_all_reels = false;
+            bench_report(TextFormat("slot_update/%s/speed%d", name, speed_upgrades), spins, "spins/s");
+            bench_report(TextFormat("slot_update_steps/%s/speed%d", name, speed_upgrades), double(steps) / spun, "steps/spin");
+
+            // the same spins out of view, straight to the stop
+            bench_report(TextFormat("slot_resolve/%s/speed%d", name, speed_upgrades), bench_rate(1, [&]() {
+                fast->click();
+                game_time = fast->spin_stop_timer.deadline;
+                events.run(game_time);
+            }), "spins/s");
+            delete fast;
         }
     }
+
+    delete machine;
 }
 
-void roll_shop() {
-    shop_entries.clear();
-    for (int i = 0; i < 3; i++) {
-        shop_entries.push_back(roll_shop_entry());
+// A floor grown all the way, every spot auto spinning, one simulation step
+// at a time like the game does it
+void bench_floor() {
+    init_game();
+    grow_floor(FLOOR_MAX_SHELLS);
+    for (int i = 0; i < spot_count; i++) {
+        unlock_spot(i);
+        place_machine(i, make_machine(bench_machine_types[i % ARRAY_SIZE(bench_machine_types)]));
+        for (int upgrade = 0; upgrade < 4; upgrade++)
+            machines[i]->upgrade(UpgradeType::Auto_Click);
     }
+    money = INT64_MAX / 2; // nobody goes bankrupt
+
+    bench_report(TextFormat("floor.update/%d_machines", spot_count), bench_rate(SIM_DT, []() {
+        update_game(SIM_DT);
+    }), "game seconds/s");
+    init_game();
 }
 
-void check_illegal_machines() {
-    bool ok = true;
-    for (Machine* machine : machines)
-        if (machine && machine->upgrades > max_upgrades)
-            ok = false;
+// The 3x3 floor the way the game draws it, full of spinning machines, into an
+// offscreen target. CPU time per frame, the GPU runs behind.
+void bench_render(bool use_pack) {
+#ifdef __linux__
+    // raylib carries on without a context when GLFW fails and crashes later
+    if (!getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY")) {
+        fprintf(stderr, "Can't open a window without a display, skipping render benchmarks\n");
+        return;
+    }
+#endif
 
-    if (!ok == has_illegal_machines)
+    SetConfigFlags(FLAG_WINDOW_HIDDEN);
+    SetTraceLogLevel(LOG_WARNING);
+    InitWindow(VIEWPORT_WIDTH, VIEWPORT_HEIGHT, GAME_NAME " bench");
+    if (!IsWindowReady()) {
+        fprintf(stderr, "Can't open a window, skipping render benchmarks\n");
         return;
+    }
+    count_draw_calls();
+
+    if (use_pack) pack_open(TextFormat("%s%s", GetApplicationDirectory(), PACK_FILE));
+    for (PictureAsset& asset : picture_assets)
+        load_picture(asset.path, asset.sprite);
+    loader_start();
+    while (!loader_update(1e9)) std::this_thread::yield();
+
+    init_game();
+    for (int i = 0; i < 9; i++) {
+        unlock_spot(i);
+        place_machine(i, make_machine(bench_machine_types[i % ARRAY_SIZE(bench_machine_types)]));
+    }
 
-    has_illegal_machines = !ok;
+    RenderTexture2D target = LoadRenderTexture(VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+    int frames = 0;
+    double draw_calls = 0;
 
-    if (has_illegal_machines) {
-        police_timer = new Timer_Police();
-        police_timer->time_left = POLICE_TIME;
-        timers.push_back(police_timer);
-        PlayMusicStream(msc_police);
-    }
-}
+    animate_all_reels = true;
+    double fps = bench_rate(1, [&]() {
+        for (Machine* machine : placed_machines) {
+            SlotMachine* slot_machine = (SlotMachine*)machine;
+            if (!slot_machine->slot.spinning) slot_machine->click();
+        }
+        for (int i = 0; i < 2; i++) {
+            dt = SIM_DT;
+            game_time += SIM_DT;
+            update_reels();
+            events.run(game_time);
+        }
 
-void apply_upgrade(Machine* machine, UpgradeType type) {
-    PlaySound(snd_upgrade);
+        update_floor_cache();
+        BeginTextureMode(target);
+        ClearBackground({22,0,50,255});
+        draw_sprite(spr_background, 0, 0);
 
-    select_machine = false;
-    machine->upgrade(type);
+        BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+        for (int i = 0; i < 9; i++) {
+            Vector2 home = spot_position(i);
+            machines[i]->pos = home;
+            machines[i]->animate();
+            draw_floor_cache(i, { machines[i]->pos.x - home.x, machines[i]->pos.y - home.y });
+        }
+        EndBlendMode();
 
-    check_illegal_machines();
-}
+        for (Machine* machine : placed_machines)
+            machine->draw();
+        EndTextureMode();
 
-// --- Shop entries -------------------------------------------
+        draw_calls += draw_stats.draw_calls;
+        end_frame_stats();
+        frames++;
+    });
 
-struct ShopEntry_Machine : ShopEntry {
-    std::string text;
-    Money _cost;
-    Machine* (*construct)();
-    Texture tex;
+    animate_all_reels = false;
+    bench_report("render.grid", 1000 / fps, "ms/frame");
+    bench_report("render.grid_draw_calls", draw_calls / frames, "calls/frame");
 
-    ShopEntry_Machine(const char* name, const char* tagline, Money cost, Machine* (*construct)(), Texture tex) {
-        this->text = std::format("{} - Machine", name);
-        this->tagline = tagline;
-        this->name = this->text.c_str();
-        this->_cost = cost;
-        this->construct = construct;
-        this->tex = tex;
-    }
+    UnloadRenderTexture(target);
+    CloseWindow();
+}
 
-    virtual Money cost() override {
-        return this->_cost;
-    }
+bool write_bench_json(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
 
-    virtual void draw_icon(int x, int y) override {
-        DrawTextureEx(tex, {float(x),float(y)}, 0, 0.73, WHITE);
+    fprintf(file, "{\n  \"threads\": %u,\n  \"benchmarks\": [\n", std::thread::hardware_concurrency());
+    for (int i = 0; i < int(bench_results.size()); i++) {
+        BenchResult& result = bench_results[i];
+        fprintf(file, "    { \"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\" }%s\n",
+                result.name.c_str(), result.value, result.unit, i + 1 < int(bench_results.size()) ? "," : "");
     }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
 
-    virtual const char* lock_reason() override {
-        for (int i = 0; i < 9; i++)
-            if (spot_unlocked[i] && !machines[i])
-                return nullptr;
-        return "No empty spots";
+// ./9XGAMBLER_BENCH [--json <file>] [--filter <group>] [--no-render] [--loose]
+// Groups: weights, slot_buffer, calculate_win, calculate_ev, slot_update, floor, render.
+int main(int argc, char** argv) {
+    const char* json_path = nullptr;
+    bool render = true;
+    bool use_pack = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--json") && i + 1 < argc) json_path = argv[++i];
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc) bench_filter = argv[++i];
+        else if (!strcmp(argv[i], "--no-render")) render = false;
+        else if (!strcmp(argv[i], "--loose")) use_pack = false;
     }
 
-    virtual void buy() override {
-        gain_money(-_cost, mouse);
-        Machine* machine = this->construct();
+    // machines don't print, shake or play sounds
+    headless = true;
+    world_rng = Rng(1234);
 
-        for (int i = 0; i < 9; i++)
-            if (spot_unlocked[i] && !machines[i]) {
-                machines[i] = machine;
-                break;
-            }
+    if (bench_enabled("weights")) {
+        bench_weights("M1X1",      { {0, 23}, {1,7}, {2,5}, {3,3}, {4,2} });
+        bench_weights("MB5",       { {0,8}, {1,5}, {2,3}, {3,2}, {4,2} });
+        bench_weights("jackpot",   { {0, 6000}, {1, 2500}, {2, 1000}, {3, 499}, {4, 1} });
+        bench_weights("fine_odds", { {0, 600000}, {1, 250000}, {2, 100000}, {3, 49999}, {4, 1} });
     }
-};
-
-struct ShopEntry_Upgrade : ShopEntry {
-    UpgradeType type;
-    Money _cost;
 
-    ShopEntry_Upgrade(UpgradeType type) {
-        this->type = type;
-        this->_cost = 200;
+    for (MachineType type : bench_machine_types)
+        bench_machine(type);
 
-        switch (this->type) {
-            case UpgradeType::Speed: {
-                this->name = "SPEED UPGRADE";
-                this->tagline = "Increase a Machine's Speed";
+    if (bench_enabled("floor")) bench_floor();
 
-                break;
-            }
-            case UpgradeType::Auto_Click: {
-                this->name = "AUTO SPIN UPGRADE";
-                this->tagline = "Increase a Machine's Auto Spin Rate";
-                break;
-            }
-            case UpgradeType::Double_Stake: {
-                this->name = "STAKE DOUBLE UPGRADE";
-                this->tagline = "Double a Machine's Stake (and thus wins!)";
-                break;
-            }
-        }
+    if (render && bench_enabled("render")) bench_render(use_pack);
 
-        this->tagline = tagline;
+    if (json_path && !write_bench_json(json_path)) {
+        fprintf(stderr, "Can't write %s\n", json_path);
+        return 1;
     }
+    return 0;
+}
 
-    virtual Money cost() override {
-        return this->_cost;
-    }
+#else
 
-    virtual void buy() override {
-        gain_money(-_cost, mouse);
-        select_machine = true;
-        select_machine_text = this->name;
-        select_machine_callback = [](Machine* machine) {
-            apply_upgrade(machine, current_upgarde_type);
-        };
-        current_upgarde_type = this->type;
-        _cost *= UPGRADE_COST_INCREASE_FACTOR;
-    }
+// --- Send it ------------------------------------------------
 
-    virtual const char* lock_reason() override {
-        for (int i = 0; i < 9; i++)
-            if (machines[i])
-                return nullptr;
-        return "Buy some machines first";
+int main(int argc, char** argv) {
+    auto program_start = std::chrono::steady_clock::now();
+    u64 seed = std::chrono::system_clock::now().time_since_epoch().count();
+    bool ev_check = false;
+    int fps = 60; // only rendering, the simulation runs at SIM_DT regardless
+    HeadlessConfig headless_config;
+    const char* pack_path = nullptr;
+    bool use_pack = true;
+    bool new_game = false;
+    const char* record_path = nullptr;
+    const char* replay_path = nullptr;
+    const char* machines_path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--check-ev")) ev_check = true;
+        else if (!strcmp(argv[i], "--headless")) headless = true;
+        else if (!strcmp(argv[i], "--time") && i + 1 < argc) headless_config.time = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--runs") && i + 1 < argc) headless_config.runs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--curve") && i + 1 < argc) headless_config.curve = argv[++i];
+        else if (!strcmp(argv[i], "--fps") && i + 1 < argc) fps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--pack") && i + 1 < argc) pack_path = argv[++i];
+        else if (!strcmp(argv[i], "--loose")) use_pack = false;
+        else if (!strcmp(argv[i], "--new")) new_game = true;
+        else if (!strcmp(argv[i], "--record") && i + 1 < argc) record_path = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc) replay_path = argv[++i];
+        else if (!strcmp(argv[i], "--machines") && i + 1 < argc) machines_path = argv[++i];
     }
 
-    virtual void draw_icon(int x, int y) override {
-        DrawRectangle(x, y, 130, 180, GOLD);
-    };
-};
+    if (pack_path) return write_pack(pack_path);
+    if (machines_path && !load_machine_defs(machines_path)) return 1;
 
-// --- Send it ------------------------------------------------
+    if (replay_path) {
+        if (!read_replay(replay_path)) {
+            fprintf(stderr, "Can't read replay %s\n", replay_path);
+            return 1;
+        }
+        seed = replay.seed;
+    }
+    replay.recording = record_path != nullptr;
+    replay.seed = seed;
+
+    world_rng = Rng(seed);
+    printf("Seed: %lu\n", seed);
+
+    if (ev_check) return check_ev();
+    if (headless && replay_path) {
+        init_game();
+        int result = run_replay_headless();
+        if (record_path && !write_replay(record_path)) {
+            fprintf(stderr, "Can't write replay %s\n", record_path);
+            return 1;
+        }
+        return result;
+    }
+    if (headless) {
+        headless_config.record = record_path;
+        return run_headless(headless_config);
+    }
 
-int main() {
     SetConfigFlags(/*FLAG_VSYNC_HINT  | */ FLAG_WINDOW_RESIZABLE);
     InitWindow(screen_width, screen_height, GAME_NAME);
     InitAudioDevice();
-    SetTargetFPS(60);
+    SetTargetFPS(fps);
+    count_draw_calls();
 
     // --- Load Assets --------------------------------------------
 
-    tex_background = LoadTexture("assets/background.png");
-    tex_m1x1 = LoadTexture("assets/m1x1.png");
-    tex_m3x1 = LoadTexture("assets/m3x1.png");
-    tex_mb5 = LoadTexture("assets/mb5.png");
-
-    tex_tile_0        = LoadTexture("assets/tile_0.png");
-    tex_tile_dot      = LoadTexture("assets/tile_dot.png");
-    tex_tile_cherry   = LoadTexture("assets/tile_cherry.png");
-    tex_tile_orange   = LoadTexture("assets/tile_orange.png");
-    tex_tile_7        = LoadTexture("assets/tile_7.png");
-    tex_tile_777      = LoadTexture("assets/tile_777.png");
-
-    tex_tile_9     = LoadTexture("assets/tile_9.png");
-    tex_tile_10    = LoadTexture("assets/tile_10.png");
-    tex_tile_j     = LoadTexture("assets/tile_j.png");
-    tex_tile_q     = LoadTexture("assets/tile_q.png");
-    tex_tile_k     = LoadTexture("assets/tile_k.png");
-
-    snd_upgrade = LoadSound("assets/upgrade.wav");
-    snd_win[0] = LoadSound("assets/win1.wav");
-    snd_win[1] = LoadSound("assets/win2.wav");
-
-    for (int i = 0; i < 48; i++) {
-        snd_hat[i] = LoadSound("assets/hat.wav");
-        SetSoundPitch(snd_hat[i], GetRandomValue(0, 100) / 100.0f * 0.1 + 0.9f);
-        SetSoundVolume(snd_hat[i], GetRandomValue(0, 100) / 100.0f * 0.3 + 0.3f);
-    }
-    snd_reelstop = LoadSound("assets/reelstop.wav");
-    msc_police = LoadMusicStream("assets/police.wav");
-    msc_police.looping = true;
-    SetMusicVolume(msc_police, 0.3);
-
-    msc_anticipation = LoadMusicStream("assets/anticipation.wav");
-    msc_anticipation.looping = true;
-    SetMusicVolume(msc_anticipation, 0.3);
-
-    // --- Init gameplay ------------------------------------------
-
-    ShopEntry* shop_entry_m1x1 = new ShopEntry_Machine(
-        "1X1",
-        "Baby's first slot machine. Low Volatility",
-        500,
-        []() -> Machine* { return new M1X1(); },
-        tex_m1x1
-    );
-
-    ShopEntry* shop_entry_m3x1 = new ShopEntry_Machine(
-        "3X1",
-        "Match 3 to win. Medium Volatility",
-        500,
-        []() -> Machine* { return new M3X1(); },
-        tex_m3x1
-    );
-
-    ShopEntry* shop_entry_mb5 = new ShopEntry_Machine(
-        "BLOODY 5",
-        "Get 5 of a kind to win. Medium Volatility",
-        1000,
-        []() -> Machine* { return new MB5(); },
-        tex_mb5
-    );
+    if (use_pack) pack_open(TextFormat("%s%s", GetApplicationDirectory(), PACK_FILE));
 
-    // --- Init shop ----------------------------------------------
+    for (PictureAsset& asset : picture_assets)
+        load_picture(asset.path, asset.sprite);
+    for (SoundDef& def : sounds)
+        load_sound(&def);
 
-    ShopEntry* shop_entry_upgrade_speed = new ShopEntry_Upgrade(UpgradeType::Speed);
-    ShopEntry* shop_entry_upgrade_auto_click = new ShopEntry_Upgrade(UpgradeType::Auto_Click);
-    ShopEntry* shop_entry_upgrade_double_stake = new ShopEntry_Upgrade(UpgradeType::Double_Stake);
+    loader_start();
 
-    shop_machines_weights.add(shop_entry_m1x1, 8);
-    shop_machines_weights.add(shop_entry_m3x1, 4);
-    shop_machines_weights.add(shop_entry_mb5, 3);
+    bool first_frame = true;
+    while (!loader_update(LOADER_BUDGET)) {
+        if (WindowShouldClose()) {
+            loader_join();
+            CloseWindow();
+            return 0;
+        }
 
-    shop_upgrades_weights.add(shop_entry_upgrade_auto_click, 1);
-    shop_upgrades_weights.add(shop_entry_upgrade_double_stake, 1);
-    shop_upgrades_weights.add(shop_entry_upgrade_speed, 1);
+        int w = GetScreenWidth();
+        int h = GetScreenHeight();
+        BeginDrawing();
+        ClearBackground(BLACK);
+        DrawRectangle(w / 4, h / 2 - 10, w / 2, 20, DARKGRAY);
+        DrawRectangle(w / 4, h / 2 - 10, w / 2 * loader_progress(), 20, GREEN);
+        EndDrawing();
 
-    shop_types_weights.add(ShopEntryType::Machine, 10);
-    shop_types_weights.add(ShopEntryType::Upgrade, 3);
+        if (first_frame) {
+            first_frame = false;
+            printf("First frame after %.1f ms\n", seconds_since(program_start) * 1000);
+        }
+    }
 
-    roll_shop();
+    msc_police = load_music(music_assets[0]);
+    msc_police.looping = true;
+    SetMusicVolume(msc_police, 0.3);
 
-    // --- Init taxes ---------------------------------------------
-    Timer_Tax* tax_car = new Timer_Tax("Car Payment", 199, 500);
-    Timer_Tax* tax_rent = new Timer_Tax("Rent", 299, 1000);
-    timers.push_back(tax_car);
-    timers.push_back(tax_rent);
+    msc_anticipation = load_music(music_assets[1]);
+    msc_anticipation.looping = true;
+    SetMusicVolume(msc_anticipation, 0.3);
 
-    display_money = money;
+    init_game();
+    printf("Loaded after %.1f ms\n", seconds_since(program_start) * 1000);
 
-    run_start_time = GetTime();
+    const char* save_path = TextFormat("%s%s", GetApplicationDirectory(), SAVE_FILE);
+    SaveState save;
+    bool scripted = record_path || replay_path; // a recorded run starts fresh and isn't saved
+    if (!new_game && !scripted && read_save_file(save_path, save) && apply_save(save)) {
+        double away = std::clamp(double(time(nullptr) - save.header.saved_at), 0.0, double(MAX_OFFLINE_TIME));
+        FastForwardReport report = fast_forward(away);
+        printf("Welcome back! %.0fs away, %.0f spins made $%ld\n", report.seconds, report.spins, report.net);
+    }
+    if (!scripted) autosave_start(save_path);
+#ifndef NDEBUG
+    profile_start();
+#endif
 
     while (!WindowShouldClose()) {
 
         camera = {
         };
 
-        if (police_timer) UpdateMusicStream(msc_police);
-        if (msc_anticipation_count > 0) UpdateMusicStream(msc_anticipation);
+        {
+            PROFILE_SCOPE(PROF_AUDIO);
+            if (police_timer) UpdateMusicStream(msc_police);
+            if (msc_anticipation_count > 0) UpdateMusicStream(msc_anticipation);
+        }
 
         // --- Update viewport ----------------------------------------
         {
@@ -1134,106 +5141,117 @@ int main() {
 
         }
 
+        mouse = GetScreenToWorld2D(GetMousePosition(), camera);
+        if (screen == GameScreen::Machines) update_floor_view(camera);
+        else clamp_floor_view(); // the floor may have grown
+        update_floor_cache();
+
         BeginDrawing();
 
         BeginMode2D(camera);
         ClearBackground({22,0,50,255});
 
-        mouse = GetScreenToWorld2D(GetMousePosition(), camera);
-        game_time = GetTime();
-        dt = GetFrameTime();
+        // --- Simulate -----------------------------------------------
 
-        // --- Simulate machines --------------------------------------
+#ifndef NDEBUG
+        if (IsKeyPressed(KEY_F9)) issue_command(CommandType::FastForward, 60 * 60);
+#endif
 
-        for (int i = 0; i < 9; i++) {
-            if (machines[i]) machines[i]->update();
+        frame_dt = GetFrameTime();
+        sim_accumulator += std::min(frame_dt, MAX_FRAME_TIME);
+        while (sim_accumulator >= SIM_DT) {
+            update_game(SIM_DT);
+            sim_accumulator -= SIM_DT;
         }
+        sim_alpha = sim_accumulator / SIM_DT;
 
-        // --- Simulate timers ----------------------------------------
-
-        for (int i = 0; i < timers.size(); i++) {
-            Timer* timer = timers[i];
-            timer->time_left -= dt;
-
-            if (timer->time_left < 0) {
-                if (!timer->action()) {
-                    delete timer;
-                    timers[i] = timers.back();
-                    timers.pop_back();
-                    i--;
-                }
-            }
-        }
+        if (!scripted && game_time - autosave.last >= AUTOSAVE_INTERVAL) autosave_now();
 
         // --- Render game --------------------------------------------
 
-        DrawTexture(tex_background, 0, 0, WHITE);
+        draw_sprite(spr_background, 0, 0);
 
         switch (screen) {
             case GameScreen::Machines: {
-                for (int i = 0; i < ARRAY_SIZE(machines); i++) {
+                PROFILE_SCOPE(PROF_RENDER_MACHINES);
+
+                // the floor has its own camera and mouse, clipped to its side of the viewport
+                Camera2D view_camera = floor_camera(camera);
+                Vector2 view_mouse = mouse;
+                if (mouse.x < FLOOR_VIEW_WIDTH) mouse = GetScreenToWorld2D(GetMousePosition(), view_camera);
+                else mouse = { -1e9f, -1e9f };
+                bool detail = floor_view.zoom >= FLOOR_DETAIL_ZOOM;
+
+                EndMode2D();
+                BeginMode2D(view_camera);
+                BeginScissorMode(camera.offset.x, camera.offset.y, FLOOR_VIEW_WIDTH * camera.zoom, VIEWPORT_HEIGHT * camera.zoom);
+
+                // all the cached chrome first so it goes out as one batch
+                BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+                if (!detail) {
+                    draw_floor_cache_all(); // too small to see anything shake
+                }
+                else {
+                    for_visible_spots([](int i) {
+                        Machine* machine = machines[i];
+                        Vector2 home = spot_position(i);
+                        Vector2 offset = {};
+
+                        if (machine) {
+                            machine->pos = home;
+                            machine->animate();
+                            offset = { machine->pos.x - home.x, machine->pos.y - home.y };
+                        }
+
+                        draw_floor_cache(i, offset);
+                    });
+                }
+                EndBlendMode();
+
+                for_visible_spots([&](int i) {
                     Machine* machine = machines[i];
 
-                    int x = TOP_PADDING + (i % 3) * (MACHINE_WIDTH + MACHINE_GAP_X);
-                    int y = RIGHT_PADDING + (i / 3) * (MACHINE_HEIGHT + MACHINE_GAP_Y);
+                    int x = spot_position(i).x;
+                    int y = spot_position(i).y;
 
                     if (machine) {
-                        machine->pos.x = x;
-                        machine->pos.y = y;
-                        machine->draw();
+                        if (detail) machine->draw();
 
                         Rectangle r = { (float)x-8, (float)y-8, MACHINE_WIDTH+16, MACHINE_HEIGHT+16 };
                         if (select_machine && CheckCollisionPointRec(mouse, r)) {
-                            DrawRectangleLinesEx(r, 4, Color{0,255,0,255});
+                            DrawRectangleLinesEx(r, 4 / floor_view.zoom, Color{0,255,0,255});
                             if (IsMouseButtonPressed(0)) {
-                                select_machine_callback(machine);
+                                issue_command(CommandType::SelectMachine, i);
                             }
                         }
                     }
-                    else {
-                        DrawRectangle(x, y, MACHINE_WIDTH, MACHINE_HEIGHT, Color{0, 0, 0, 90});
-
-                        if (spot_unlocked[i]) {
-                            float _y = y + 5;
-                            DrawText("NO MACHINE", x + 10, _y, 20, WHITE);
-                            _y += 40;
-                            DrawText("Open the SHOP", x + 10, _y, 20, WHITE);
-                            _y += 20;
-                            DrawText("to buy one", x + 10, _y, 20, WHITE);
-                            _y += 20;
-                        }
-                        else {
-                            bool enabled = spot_prices[i] <= money;
-                            float _y = y + 5;
-                            DrawText("SPOT", x + 10, _y, 40, RED);
-                            _y += 40;
-                            DrawText("LOCKED", x + 10, _y, 40, RED);
-                            _y += 50;
-
-                            char buf[64];
-                            snprintf(buf, _y, "Price: $%ld", spot_prices[i]);
-                            DrawText(buf, x + 10, y + 90, 20,  enabled ? GREEN : RED);
-                            _y += 30;
-
-                            if (button({
-                                .rect = Rectangle{float(x + 8), float(_y), MACHINE_WIDTH - 16, y + MACHINE_HEIGHT - _y - 8 },
-                                .text = "BUY",
-                                .enabled = enabled,
-                            }) && !select_machine) {
-                                buy_spot(i);
-                            }
+                    else if (!spot_unlocked[i] && detail) {
+                        float _y = y + 5 + 40 + 50 + 30;
+                        if (button({
+                            .rect = Rectangle{float(x + 8), float(_y), MACHINE_WIDTH - 16, y + MACHINE_HEIGHT - _y - 8 },
+                            .text = "BUY",
+                            .enabled = bool(spot_affordable[i]),
+                        }) && !select_machine) {
+                            issue_command(CommandType::BuySpot, i);
                         }
                     }
-                }
+                });
+
+                EndScissorMode();
+                EndMode2D();
+                BeginMode2D(camera);
+                mouse = view_mouse;
 
                 break;
             }
             case GameScreen::Shop: {
+                PROFILE_SCOPE(PROF_RENDER_SHOP);
+
                 float y = 8;
                 float x_start = 8;
                 float x_end = 620;
 
-                DrawText("SHOP", y, 12, 40, WHITE);
+                draw_text("SHOP", y, 12, 40, WHITE);
                 if (button({
                     .rect         = { 540, y, 80, 40 },
                     .text         = "Close",
@@ -1247,7 +5265,7 @@ int main() {
                 y += 20;
 
 
-                for (int i = 0; i < shop_entries.size(); i++) {
+                for (int i = 0; i < int(shop_entries.size()); i++) {
                     const int height = 200;
                     DrawRectangle(x_start, y, x_end - x_start, height, BLACK);
 
@@ -1264,14 +5282,12 @@ int main() {
 
 
                     entry->draw_icon(x_start + 10, y + 10);
-                    DrawText(entry->name, x_start + 150, y + 4, 20, WHITE);
-                    DrawText(entry->tagline, x_start + 150, y + 24, 20, WHITE);
-
-                    char buf[64] = {};
-                    snprintf(buf, 64, "$%ld", cost);
+                    draw_text(entry->name, x_start + 150, y + 4, 20, WHITE);
+                    draw_text(entry->tagline, x_start + 150, y + 24, 20, WHITE);
 
-                    int len = MeasureText(buf, 40);
-                    DrawText(buf, x_end - 130 - 8 - len, y + 10 + 134, 40, can_afford ? WHITE : RED);
+                    const char* price = entry->price_label.format(cost, "$%ld", cost);
+                    int len = measure_text(price, 40);
+                    draw_text(price, x_end - 130 - 8 - len, y + 10 + 134, 40, can_afford ? WHITE : RED);
 
                     Rectangle button_rect = { x_end - 130, y + 6 + 134, 122, 47 };
                     if (button({
@@ -1281,8 +5297,7 @@ int main() {
                         .enabled      = can_afford && !entry->lock_reason(),
                     })) {
                         go_to_screen(GameScreen::Machines);
-                        entry->buy();
-                        shop_entries[i] = nullptr;
+                        issue_command(CommandType::BuyShopEntry, i);
                     }
 
                     if (CheckCollisionPointRec(mouse, button_rect)) {
@@ -1295,155 +5310,181 @@ int main() {
                     y += height + 10;
                 }
 
-                char buf[256];
-                snprintf(buf, sizeof(buf), "REROLL - $%ld", roll_cost);
-
+                static Label reroll_label;
                 Rectangle button_rect = { x_start, y, 400, 50 };
                 if (button({
                     .rect         = button_rect,
-                    .text         = buf,
+                    .text         = reroll_label.format(roll_cost, "REROLL - $%ld", roll_cost),
                     .background   = DARKGREEN,
                     .font_size    = 40,
                     .enabled      = money >= roll_cost,
                 })) {
-                    roll_cost *= ROLL_COST_INCREASE_FACTOR;
-                    gain_money(-roll_cost, mouse);
-                    roll_shop();
+                    issue_command(CommandType::Reroll);
                 }
             }
         }
 
 
-        // --- Draw money ------------------------------------------
-
-        char buf[64];
-        display_money = Lerp(display_money, double(money), 10 * dt);
-        snprintf(buf, 64, "%ld", i64(roundf(display_money)));
-        int _y = 154;
-        DrawText(buf, 714, _y, 40, WHITE);
-        _y += 50;
-
-        // --- Draw time spent solvent -----------------------------
-
-        double time_solvent = game_time - run_start_time;
-        snprintf(buf, 64, "%d:%.2d", int(time_solvent / 60), int(floor(time_solvent)) % 60);
-        DrawText("Time spent Solvent", 700, _y, 20, WHITE);
-        DrawText(buf, 900, _y, 40, WHITE);
-        _y += 30;
-
-        // --- Draw shop button -----------------------------
+        {
+            PROFILE_SCOPE(PROF_HUD);
+
+            // --- Draw money ------------------------------------------
+
+            static Label money_label;
+            display_money = Lerp(display_money, double(money), std::min(1.0, 10 * frame_dt));
+            i64 shown_money = i64(roundf(display_money));
+            int _y = 154;
+            draw_text(money_label.format(shown_money, "%ld", shown_money), 714, _y, 40, WHITE);
+            _y += 50;
+
+            // --- Draw time spent solvent -----------------------------
+
+            static Label solvent_label;
+            int time_solvent = floor(game_time - run_start_time);
+            draw_text("Time spent Solvent", 700, _y, 20, WHITE);
+            draw_text(solvent_label.format(time_solvent, "%d:%.2d", time_solvent / 60, time_solvent % 60), 900, _y, 40, WHITE);
+            _y += 30;
+
+            // --- Draw shop button -----------------------------
+
+            if (button({
+                .rect         = { 700, float(_y), 150, 45 },
+                .text         = "SHOP",
+                .background   = BLUE,
+                .text_color   = WHITE,
+                .font_size    = 40,
+            })) {
+                go_to_screen(screen == GameScreen::Shop ? GameScreen::Machines : GameScreen::Shop);
+            }
 
-        if (button({
-            .rect         = { 700, float(_y), 150, 45 },
-            .text         = "SHOP",
-            .background   = BLUE,
-            .text_color   = WHITE,
-            .font_size    = 40,
-        })) {
-            go_to_screen(screen == GameScreen::Shop ? GameScreen::Machines : GameScreen::Shop);
-        }
+            // --- Draw timers ----------------------------------
 
-        // --- Draw timers ----------------------------------
+            Timer* next_timers[5];
+            int next_count = timers.peek(next_timers, ARRAY_SIZE(next_timers));
 
-        std::sort(timers.begin(), timers.end(), [](const Timer* a, const Timer* b) { return a->time_left < b->time_left; });
+            _y += 50;
+            for (int i = 0; i < next_count; i++) {
+                Timer* timer = next_timers[i];
 
-        _y += 50;
-        for (int i = 0; i < timers.size() && i < 5; i++) {
-            Timer* timer = timers[i];
+                DrawRectangle(652, _y, 1024 - 650 - 5, 52, BLACK); 
 
-            DrawRectangle(652, _y, 1024 - 650 - 5, 52, BLACK); 
+                draw_text(timer->text, 660, _y, 20, WHITE);
+                _y += 25;
 
-            snprintf(buf, sizeof(buf), "%s", timer->text);
-            DrawText(buf, 660, _y, 20, WHITE);
-            _y += 25;
+                double time_left = timer->time_left();
+                int seconds = floor(time_left);
+                const char* time = timer->time_label.format(seconds, "%d:%.2d", int(time_left / 60), seconds % 60);
+                int len = measure_text(time, 30);
+                draw_text(time, 1024 - len - 10, _y, 30, WHITE);
 
+                if (timer->cost) {
+                    draw_text(timer->cost_label.format(timer->cost, "$%ld", timer->cost), 660, _y, 30, WHITE);
+                }
 
-            snprintf(buf, sizeof(buf), "%d:%.2d", int(timer->time_left / 60), int(floor(timer->time_left)) % 60);
-            int len = MeasureText(buf, 30);
-            DrawText(buf, 1024 - len - 10, _y, 30, WHITE);
-            // DrawText(buf, 660, _y, 30, WHITE);
 
-            if (timer->cost) {
-                snprintf(buf, sizeof(buf), "$%ld", timer->cost);
-                DrawText(buf, 660, _y, 30, WHITE);
+                _y += 34;
             }
-
-
-            _y += 34;
         }
 
         // --- Draw texts on screen -------------------------
 
-        for (int i = 0; i < texts.size(); i++) {
-            TextOnScreen& text = texts[i];
-            float t = pow(text.t / text.duration, 2);
-
-            text.pos.x += text.velocity.x * dt;
-            text.pos.y += text.velocity.y * dt;
-            text.velocity.y += text.gravity * dt;
-
-
-            Color color = text.color;
-            if (t > 0.8)
-                color.a = Remap(t, 0.8, 1, 255, 0);
-
-            DrawText(text.text.c_str(), text.pos.x, text.pos.y, text.size, {0,0,0,color.a});
-            DrawText(text.text.c_str(), text.pos.x + 1, text.pos.y, text.size, color);
-
-            text.t += GetFrameTime();
-
-            if (text.t > text.duration) {
-                texts[i] = texts.back();
-                texts.pop_back();
-                i--;
+        {
+            PROFILE_SCOPE(PROF_RENDER_TEXTS);
+            for (int i = 0; i < texts.count; i++) {
+                float t = pow(texts.t[i] / TEXT_DURATION, 2);
+                Vector2 pos = {
+                    Lerp(texts.prev_x[i], texts.x[i], sim_alpha),
+                    Lerp(texts.prev_y[i], texts.y[i], sim_alpha),
+                };
+
+                Color color = texts.amount[i] < 0 ? RED : GREEN;
+                if (t > 0.8)
+                    color.a = Remap(t, 0.8, 1, 255, 0);
+
+                const TextRun& run = text_run(texts.text[i], TEXT_SIZE);
+                draw_run(run, pos.x, pos.y, {0,0,0,color.a});
+                draw_run(run, pos.x + 1, pos.y, color);
             }
         }
 
-        if (select_machine) {
-            DrawRectangle(600, 0, 1024, 100, BLACK);
-            DrawText("SELECT MACHINE", 610, 10, 40, WHITE);
-            DrawText(select_machine_text, 610, 50, 20, WHITE);
-        }
+        {
+            PROFILE_SCOPE(PROF_HUD);
 
-        if (tooltip) {
-            int len = MeasureText(tooltip, 20);
-            Vector2 pos = mouse;
-            pos.y += 30;
-            if (pos.x + len > screen_width) pos.x = screen_width - len;
-            if (pos.x < 0) pos.x = 0;
-            if (pos.y + 20 > screen_height) pos.y = screen_height - 20;
-            DrawRectangle(pos.x - 4, pos.y - 4, len + 8, 28, BLACK);
-            DrawText(tooltip, pos.x, pos.y, 20, WHITE);
-        }
-        tooltip = nullptr;
+            if (select_machine) {
+                DrawRectangle(600, 0, 1024, 100, BLACK);
+                draw_text("SELECT MACHINE", 610, 10, 40, WHITE);
+                draw_text(select_machine_text, 610, 50, 20, WHITE);
+            }
 
-        if (has_illegal_machines && police_timer) {
-            double t = (game_time * 4) - int(game_time * 4);
-            
-            int py = 30;
-            DrawRectangle(0, py, 1024, 100, Color{0,0,0,200});
-            DrawText("ILLEGAL MACHINES", 100, py, 60, BLACK);
-            DrawText("ILLEGAL MACHINES", 104, py, 60, t < 0.5 ? RED : BLUE);
-            DrawText("ILLEGAL MACHINES", 108, py, 60, t > 0.5 ? RED : BLUE);
+            if (tooltip) {
+                int len = measure_text(tooltip, 20);
+                Vector2 pos = mouse;
+                pos.y += 30;
+                if (pos.x + len > screen_width) pos.x = screen_width - len;
+                if (pos.x < 0) pos.x = 0;
+                if (pos.y + 20 > screen_height) pos.y = screen_height - 20;
+                DrawRectangle(pos.x - 4, pos.y - 4, len + 8, 28, BLACK);
+                draw_text(tooltip, pos.x, pos.y, 20, WHITE);
+            }
+            tooltip = nullptr;
 
-            char buf[64] = {};
-            snprintf(buf, 64, "POLICE INCOMING IN %d:%.2d", int(police_timer->time_left / 60), int(floor(police_timer->time_left)) % 60);
-            DrawText(buf, 100,  py + 60, 40, t < 0.5 ? RED : BLUE);
-            DrawText(buf, 104,  py + 60, 40, t < 0.5 ? BLUE : RED);
+            if (has_illegal_machines && police_timer) {
+                double t = (game_time * 4) - int(game_time * 4);
+            
+                int py = 30;
+                DrawRectangle(0, py, 1024, 100, Color{0,0,0,200});
+                draw_text("ILLEGAL MACHINES", 100, py, 60, BLACK);
+                draw_text("ILLEGAL MACHINES", 104, py, 60, t < 0.5 ? RED : BLUE);
+                draw_text("ILLEGAL MACHINES", 108, py, 60, t > 0.5 ? RED : BLUE);
+
+                static Label police_label;
+                double time_left = police_timer->time_left();
+                int seconds = floor(time_left);
+                const char* warning = police_label.format(seconds, "POLICE INCOMING IN %d:%.2d", int(time_left / 60), seconds % 60);
+                draw_text(warning, 100,  py + 60, 40, t < 0.5 ? RED : BLUE);
+                draw_text(warning, 104,  py + 60, 40, t < 0.5 ? BLUE : RED);
+            }
         }
 
         EndMode2D();
 
-        if (0) { // FPS Counter
-            char buf[64];
-            snprintf(buf, 64, "FPS: %d", GetFPS());
-            DrawText(buf, 8, 8, 20, WHITE);
+        if (IsKeyPressed(KEY_F3)) debug_overlay = !debug_overlay;
+        if (debug_overlay) {
+            static Label fps_label, draw_calls_label, text_cache_label, texts_label, allocations_label;
+            DrawRectangle(0, 0, 220, 112, Color{0,0,0,160});
+            draw_text(fps_label.format(GetFPS(), "FPS: %d", GetFPS()), 8, 8, 20, WHITE);
+            draw_text(draw_calls_label.format(draw_stats.last_draw_calls, "Draw calls: %d", draw_stats.last_draw_calls), 8, 28, 20, WHITE);
+            draw_text(text_cache_label.format(text_cache.size(), "Text runs: %d", int(text_cache.size())), 8, 48, 20, WHITE);
+            draw_text(texts_label.format(texts.count, "Popups: %d", texts.count), 8, 68, 20, WHITE);
+#ifndef NDEBUG
+            draw_text(allocations_label.format(draw_stats.last_allocations, "Allocs/frame: %d", int(draw_stats.last_allocations)), 8, 88, 20, WHITE);
+            draw_profiler(0, 112);
+#endif
+        }
+#ifndef NDEBUG
+        if (IsKeyPressed(KEY_F4)) {
+            if (write_trace(PROFILE_TRACE)) printf("Wrote %s\n", PROFILE_TRACE);
+            else fprintf(stderr, "Can't write %s\n", PROFILE_TRACE);
         }
+#endif
 
         EndDrawing();
+#ifndef NDEBUG
+        profile_end_frame();
+#endif
+        end_frame_stats();
+        sweep_text_cache();
+        {
+            PROFILE_SCOPE(PROF_AUDIO);
+            end_audio_frame();
+        }
     }
 
+    if (!scripted) autosave_stop();
+    if (record_path && !write_replay(record_path))
+        fprintf(stderr, "Can't write replay %s\n", record_path);
     CloseWindow();
     return 0;
 }
 
+#endif